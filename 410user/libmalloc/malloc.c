@@ -1,7 +1,7 @@
 /*
  ******************************************************************************
- *                               mm-baseline.c                                *
- *           64-bit struct-based implicit free list memory allocator          *
+ *                                 mm-seglist.c                               *
+ *         64-bit struct-based segregated free list memory allocator          *
  *                  15-213: Introduction to Computer Systems                  *
  *                                                                            *
  *  ************************************************************************  *
@@ -13,30 +13,35 @@
  *  HEADER: 8-byte, aligned to 8th byte of an 16-byte aligned heap, where     *
  *          - The lowest order bit is 1 when the block is allocated, and      *
  *            0 otherwise.                                                    *
- *          - The whole 8-byte value with the least significant bit set to 0  *
- *            represents the size of the block as a size_t                    *
- *            The size of a block includes the header and footer.             *
+ *          - The second lowest order bit is 1 when the previous block on     *
+ *            the heap is allocated, and 0 otherwise.                         *
+ *          - The whole 8-byte value with the 4 least significant bits set    *
+ *            to 0 represents the size of the block as a size_t               *
+ *            The size of a block includes the header (and footer).           *
  *  FOOTER: 8-byte, aligned to 0th byte of an 16-byte aligned heap. It        *
- *          contains the exact copy of the block's header.                    *
+ *          contains the size of the block. Only free blocks have a footer:   *
+ *          it is needed to find the start of the previous block when         *
+ *          coalescing, which only happens when that block is free, as told   *
+ *          by the header's second bit.                                       *
  *  The minimum blocksize is 32 bytes.                                        *
  *                                                                            *
  *  Allocated blocks contain the following:                                   *
  *  HEADER, as defined above.                                                 *
  *  PAYLOAD: Memory allocated for program to store information.               *
- *  FOOTER, as defined above.                                                 *
- *  The size of an allocated block is exactly PAYLOAD + HEADER + FOOTER.      *
+ *  The size of an allocated block is PAYLOAD + HEADER rounded up to 16.      *
  *                                                                            *
  *  Free blocks contain the following:                                        *
  *  HEADER, as defined above.                                                 *
+ *  NEXT, PREV: pointers to the neighbours of the block in its free list.     *
  *  FOOTER, as defined above.                                                 *
  *  The size of an unallocated block is at least 32 bytes.                    *
  *                                                                            *
  *  Block Visualization.                                                      *
- *                    block     block+8          block+size-8   block+size    *
- *  Allocated blocks:   |  HEADER  |  ... PAYLOAD ...  |  FOOTER  |           *
+ *                    block     block+8                         block+size    *
+ *  Allocated blocks:   |  HEADER  |  ... PAYLOAD ...                 |       *
  *                                                                            *
- *                    block     block+8          block+size-8   block+size    *
- *  Unallocated blocks: |  HEADER  |  ... (empty) ...  |  FOOTER  |           *
+ *                    block     block+8            block+size-8   block+size  *
+ *  Unallocated blocks: |  HEADER  | NEXT | PREV | ... |  FOOTER  |           *
  *                                                                            *
  *  ************************************************************************  *
  *  ** INITIALIZATION. **                                                     *
@@ -44,37 +49,46 @@
  *  The following visualization reflects the beginning of the heap.           *
  *      start            start+8           start+16                           *
  *  INIT: | PROLOGUE_FOOTER | EPILOGUE_HEADER |                               *
- *  PROLOGUE_FOOTER: 8-byte footer, as defined above, that simulates the      *
- *                    end of an allocated block. Also serves as padding.      *
+ *  PROLOGUE_FOOTER: 8-byte footer that simulates the end of an allocated     *
+ *                   block. Also serves as padding.                           *
  *  EPILOGUE_HEADER: 8-byte block indicating the end of the heap.             *
  *                   It simulates the beginning of an allocated block         *
  *                   The epilogue header is moved when the heap is extended.  *
  *                                                                            *
  *  ************************************************************************  *
+ *  ** FREE LISTS. **                                                         *
+ *                                                                            *
+ *  Free blocks are kept in NUM_CLASSES doubly linked lists, one per size     *
+ *  class. The first classes hold a single block size each (32 to 128 bytes   *
+ *  in steps of 16), the following ones hold power-of-two ranges of sizes,    *
+ *  and the last one holds every block of 32KB or more. Blocks are inserted   *
+ *  at the head of their list (LIFO). A bitmap records which lists are not    *
+ *  empty.                                                                    *
+ *                                                                            *
+ *  ************************************************************************  *
  *  ** BLOCK ALLOCATION. **                                                   *
  *                                                                            *
- *  Upon memory request of size S, a block of size S + dsize, rounded up to   *
- *  16 bytes, is allocated on the heap, where dsize is 2*8 = 16.              *
- *  Selecting the block for allocation is performed by finding the first      *
- *  block that can fit the content based on a first-fit or next-fit search    *
- *  policy.                                                                   *
- *  The search starts from the beginning of the heap pointed by heap_listp.   *
- *  It sequentially goes through each block in the implicit free list,        *
- *  the end of the heap, until either                                         *
- *  - A sufficiently-large unallocated block is found, or                     *
- *  - The end of the implicit free list is reached, which occurs              *
- *    when no sufficiently-large unallocated block is available.              *
- *  In case that a sufficiently-large unallocated block is found, then        *
- *  that block will be used for allocation. Otherwise--that is, when no       *
- *  sufficiently-large unallocated block is found--then more unallocated      *
- *  memory of size chunksize or requested size, whichever is larger, is       *
- *  requested through mem_sbrk, and the search is redone.                     *
+ *  Upon memory request of size S, a block of size S + wsize, rounded up to   *
+ *  16 bytes, is allocated on the heap, where wsize is 8.                     *
+ *  The block is taken from the free list of its size class, using first fit  *
+ *  in that list (any block fits in the single-size classes). If that list    *
+ *  has no fit, the head of the first non-empty list of a larger class is     *
+ *  used, which is found in constant time with the bitmap. Only when every    *
+ *  such list is empty is more memory of size chunksize or requested size,    *
+ *  whichever is larger, requested through mem_sbrk.                          *
+ *  The part of the chosen block which is not needed is split off and put     *
+ *  back in a free list if it is at least the minimum block size.             *
  *                                                                            *
  *  ************************************************************************  *
- *  ** ADVICE FOR STUDENTS. **                                                *
- *  Step 0: Please read the writeup!                                          *
- *  Write your heap checker. Write your heap checker. Write. Heap. checker.   *
- *  Good luck, and have fun!                                                  *
+ *  ** FREEING AND COALESCING. **                                             *
+ *                                                                            *
+ *  A freed block is immediately merged with its neighbours if they are       *
+ *  free. The next block is found through the block's size and the previous   *
+ *  one through its footer, so coalescing takes constant time. Free           *
+ *  neighbours are unlinked from their lists in constant time as well, and    *
+ *  the merged block is inserted in the list of its new size class.           *
+ *                                                                            *
+ *  Define DEBUG to check the whole heap before and after every call.         *
  *                                                                            *
  ******************************************************************************
  */
@@ -91,9 +105,15 @@
 
 #include "memlib.h"
 
+#ifdef DEBUG
 #define dbg_requires(...) assert(__VA_ARGS__)
 #define dbg_assert(...) assert(__VA_ARGS__)
 #define dbg_ensures(...) assert(__VA_ARGS__)
+#else
+#define dbg_requires(...)
+#define dbg_assert(...)
+#define dbg_ensures(...)
+#endif
 
 /* Basic constants */
 typedef uint64_t word_t;
@@ -101,20 +121,36 @@ static const size_t wsize = sizeof(word_t);   // word and header size (bytes)
 static const size_t dsize = 2*sizeof(word_t);          // double word size (bytes)
 static const size_t min_block_size = 4*sizeof(word_t); // Minimum block size
 static const size_t chunksize = (1 << 12);    // requires (chunksize % 16 == 0)
+static const size_t max_request = ((size_t)-1) / 2; // Larger sizes overflow
 
 static const word_t alloc_mask = 0x1;
+static const word_t prev_alloc_mask = 0x2;
 static const word_t size_mask = ~(word_t)0xF;
 
+/* Number of segregated free lists */
+#define NUM_CLASSES 16
+/* Number of free lists holding a single block size */
+#define NUM_EXACT_CLASSES 7
+
 typedef struct block
 {
-    /* Header contains size + allocation flag */
+    /* Header contains size + allocation flags */
     word_t header;
-    /*
-     * We don't know how big the payload will be.  Declaring it as an
-     * array of size 0 allows computing its starting address using
-     * pointer notation.
-     */
-    char payload[0];
+    union
+    {
+        /* Links in the free list, only valid while the block is free */
+        struct
+        {
+            struct block *next;
+            struct block *prev;
+        };
+        /*
+         * We don't know how big the payload will be.  Declaring it as an
+         * array of size 0 allows computing its starting address using
+         * pointer notation.
+         */
+        char payload[0];
+    };
     /*
      * We can't declare the footer as part of the struct, since its starting
      * position is unknown
@@ -125,16 +161,26 @@ typedef struct block
 /* Global variables */
 /* Pointer to first block */
 static block_t *heap_listp = NULL;
+/* Heads of the segregated free lists */
+static block_t *free_lists[NUM_CLASSES];
+/* Bit i is set when free_lists[i] is not empty */
+static unsigned int class_map = 0;
 
 /* Function prototypes for internal helper routines */
 static block_t *extend_heap(size_t size);
 static void place(block_t *block, size_t asize);
+static void split(block_t *block, size_t asize);
 static block_t *find_fit(size_t asize);
 static block_t *coalesce(block_t *block);
 
+static int get_class(size_t size);
+static void insert_free(block_t *block);
+static void remove_free(block_t *block);
+
 static size_t max(size_t x, size_t y);
 static size_t round_up(size_t size, size_t n);
-static word_t pack(size_t size, bool alloc);
+static size_t adjust_size(size_t size);
+static word_t pack(size_t size, bool alloc, bool prev_alloc);
 
 static size_t extract_size(word_t header);
 static size_t get_size(block_t *block);
@@ -142,9 +188,12 @@ static size_t get_payload_size(block_t *block);
 
 static bool extract_alloc(word_t header);
 static bool get_alloc(block_t *block);
+static bool get_prev_alloc(block_t *block);
+static void set_prev_alloc(block_t *block, bool prev_alloc);
 
-static void write_header(block_t *block, size_t size, bool alloc);
-static void write_footer(block_t *block, size_t size, bool alloc);
+static void write_header(block_t *block, size_t size, bool alloc,
+                         bool prev_alloc);
+static void write_footer(block_t *block, size_t size);
 
 static block_t *payload_to_header(void *bp);
 static void *header_to_payload(block_t *block);
@@ -164,6 +213,8 @@ bool mm_checkheap(int lineno);
  */
 bool mm_init(void)
 {
+    int i;
+
     mem_init(0xffffffff);
 
     // Create the initial empty heap
@@ -174,8 +225,14 @@ bool mm_init(void)
         return false;
     }
 
-    start[0] = pack(0, true); // Prologue footer
-    start[1] = pack(0, true); // Epilogue header
+    for (i = 0; i < NUM_CLASSES; i++)
+    {
+        free_lists[i] = NULL;
+    }
+    class_map = 0;
+
+    start[0] = pack(0, true, true); // Prologue footer
+    start[1] = pack(0, true, true); // Epilogue header
     // Heap starts with first block header (epilogue)
     heap_listp = (block_t *) &(start[1]);
 
@@ -188,12 +245,12 @@ bool mm_init(void)
 }
 
 /*
- * malloc: allocates a block with size at least (size + dsize), rounded up to
- *         the nearest 16 bytes, with a minimum of 2*dsize. Seeks a
- *         sufficiently-large unallocated block on the heap to be allocated.
- *         If no such block is found, extends heap by the maximum between
- *         chunksize and (size + dsize) rounded up to the nearest 16 bytes,
- *         and then attempts to allocate all, or a part of, that memory.
+ * malloc: allocates a block with size at least (size + wsize), rounded up to
+ *         the nearest 16 bytes, with a minimum of min_block_size. Takes a
+ *         sufficiently-large unallocated block from the segregated free
+ *         lists. If no such block is found, extends heap by the maximum
+ *         between chunksize and the adjusted size, and then allocates all,
+ *         or a part of, that memory.
  *         Returns NULL on failure, otherwise returns a pointer to such block.
  *         The allocated block will not be used for further allocations until
  *         freed.
@@ -210,18 +267,22 @@ void *_malloc(size_t size)
     if (heap_listp == NULL) // Initialize heap if it isn't initialized
     {
         mm_init();
+        if (heap_listp == NULL)
+        {
+            return bp;
+        }
     }
 
-    if (size == 0) // Ignore spurious request
+    if (size == 0 || size > max_request) // Ignore spurious request
     {
         dbg_ensures(mm_checkheap(__LINE__));
         return bp;
     }
 
     // Adjust block size to include overhead and to meet alignment requirements
-    asize = round_up(size, dsize) + dsize;
+    asize = adjust_size(size);
 
-    // Search the free list for a fit
+    // Search the free lists for a fit
     block = find_fit(asize);
 
     // If no fit is found, request more memory, and then and place the block
@@ -245,7 +306,8 @@ void *_malloc(size_t size)
 
 /*
  * free: Frees the block such that it is no longer allocated while still
- *       maintaining its size. Block will be available for use on malloc.
+ *       maintaining its size, and merges it with its free neighbours.
+ *       Block will be available for use on malloc.
  */
 void _free(void *bp)
 {
@@ -254,20 +316,27 @@ void _free(void *bp)
         return;
     }
 
+    dbg_requires(mm_checkheap(__LINE__));
+
     block_t *block = payload_to_header(bp);
     size_t size = get_size(block);
 
-    write_header(block, size, false);
-    write_footer(block, size, false);
+    write_header(block, size, false, get_prev_alloc(block));
+    write_footer(block, size);
+    set_prev_alloc(find_next(block), false);
 
     coalesce(block);
 
+    dbg_ensures(mm_checkheap(__LINE__));
 }
 
 /*
  * realloc: returns a pointer to an allocated region of at least size bytes:
  *          if ptrv is NULL, then call malloc(size);
  *          if size == 0, then call free(ptr) and returns NULL;
+ *          if the block is large enough, or can be made large enough by
+ *          merging it with the next block when that one is free, the block
+ *          is resized in place;
  *          else allocates new region of memory, copies old data to new memory,
  *          and then free old block. Returns old block if realloc fails or
  *          returns new pointer on success.
@@ -275,6 +344,8 @@ void _free(void *bp)
 void *_realloc(void *ptr, size_t size)
 {
     block_t *block = payload_to_header(ptr);
+    block_t *block_next;
+    size_t asize;
     size_t copysize;
     void *newptr;
 
@@ -291,6 +362,33 @@ void *_realloc(void *ptr, size_t size)
         return _malloc(size);
     }
 
+    if (size > max_request)
+    {
+        return NULL;
+    }
+
+    asize = adjust_size(size);
+
+    // The block is large enough, give back what we do not need
+    if (asize <= get_size(block))
+    {
+        split(block, asize);
+        return ptr;
+    }
+
+    // Grow the block in place by absorbing the next block if it is free
+    block_next = find_next(block);
+    if (!get_alloc(block_next) &&
+        get_size(block) + get_size(block_next) >= asize)
+    {
+        remove_free(block_next);
+        write_header(block, get_size(block) + get_size(block_next), true,
+                     get_prev_alloc(block));
+        set_prev_alloc(find_next(block), true);
+        split(block, asize);
+        return ptr;
+    }
+
     // Otherwise, proceed with reallocation
     newptr = _malloc(size);
     // If malloc fails, the original block is left untouched
@@ -314,7 +412,7 @@ void *_realloc(void *ptr, size_t size)
 }
 
 /*
- * calloc: Allocates a block with size at least (elements * size + dsize)
+ * calloc: Allocates a block with size at least (elements * size + wsize)
  *         through malloc, then initializes all bits in allocated memory to 0.
  *         Returns NULL on failure.
  */
@@ -323,7 +421,7 @@ void *_calloc(size_t nmemb, size_t size)
     void *bp;
     size_t asize = nmemb * size;
 
-    if (asize/nmemb != size)
+    if (nmemb != 0 && asize/nmemb != size)
     // Multiplication overflowed
     return NULL;
 
@@ -344,7 +442,8 @@ void *_calloc(size_t nmemb, size_t size)
  * extend_heap: Extends the heap with the requested number of bytes, and
  *              recreates epilogue header. Returns a pointer to the result of
  *              coalescing the newly-created block with previous free block, if
- *              applicable, or NULL in failure.
+ *              applicable, or NULL in failure. The returned block is in its
+ *              free list.
  */
 static block_t *extend_heap(size_t size)
 {
@@ -357,110 +456,182 @@ static block_t *extend_heap(size_t size)
         return NULL;
     }
 
-    // Initialize free block header/footer
+    // Initialize free block header/footer. The block starts where the old
+    // epilogue was, which knows whether the last block is allocated
     block_t *block = payload_to_header(bp);
-    write_header(block, size, false);
-    write_footer(block, size, false);
+    write_header(block, size, false, get_prev_alloc(block));
+    write_footer(block, size);
     // Create new epilogue header
     block_t *block_next = find_next(block);
-    write_header(block_next, 0, true);
+    write_header(block_next, 0, true, false);
 
     // Coalesce in case the previous block was free
     return coalesce(block);
 }
 
-/* Coalesce: Coalesces current block with previous and next blocks if either
- *           or both are unallocated; otherwise the block is not modified.
+/* Coalesce: Merges a free block, which is not in any free list yet, with
+ *           the previous and next blocks if either or both are unallocated,
+ *           and inserts the result in its free list.
  *           Returns pointer to the coalesced block. After coalescing, the
  *           immediate contiguous previous and next blocks must be allocated.
  */
 static block_t *coalesce(block_t * block)
 {
     block_t *block_next = find_next(block);
-    block_t *block_prev = find_prev(block);
-
-    bool prev_alloc = extract_alloc(*(find_prev_footer(block)));
-    bool next_alloc = get_alloc(block_next);
     size_t size = get_size(block);
 
-    if (prev_alloc && next_alloc)              // Case 1
-    {
-        return block;
-    }
-
-    else if (prev_alloc && !next_alloc)        // Case 2
+    if (!get_alloc(block_next))                // Merge with next block
     {
+        remove_free(block_next);
         size += get_size(block_next);
-        write_header(block, size, false);
-        write_footer(block, size, false);
     }
 
-    else if (!prev_alloc && next_alloc)        // Case 3
+    if (!get_prev_alloc(block))                // Merge with previous block
     {
-        size += get_size(block_prev);
-        write_header(block_prev, size, false);
-        write_footer(block_prev, size, false);
-        block = block_prev;
+        block = find_prev(block);
+        remove_free(block);
+        size += get_size(block);
     }
 
-    else                                        // Case 4
-    {
-        size += get_size(block_next) + get_size(block_prev);
-        write_header(block_prev, size, false);
-        write_footer(block_prev, size, false);
+    // Free blocks are never adjacent, so the previous block is allocated
+    write_header(block, size, false, true);
+    write_footer(block, size);
+    insert_free(block);
 
-        block = block_prev;
-    }
     return block;
 }
 
 /*
- * place: Places block with size of asize at the start of bp. If the remaining
- *        size is at least the minimum block size, then split the block to the
- *        the allocated block and the remaining block as free, which is then
- *        inserted into the segregated list. Requires that the block is
- *        initially unallocated.
+ * place: Allocates the asize first bytes of a free block taken from the
+ *        free lists. If the remaining size is at least the minimum block
+ *        size, then the remaining block is freed, which inserts it into the
+ *        segregated list.
  */
 static void place(block_t *block, size_t asize)
+{
+    remove_free(block);
+
+    write_header(block, get_size(block), true, get_prev_alloc(block));
+    set_prev_alloc(find_next(block), true);
+
+    split(block, asize);
+}
+
+/*
+ * split: Shrinks an allocated block to asize bytes if the remaining size
+ *        is at least the minimum block size. The remaining block is freed.
+ */
+static void split(block_t *block, size_t asize)
 {
     size_t csize = get_size(block);
 
+    dbg_requires(get_alloc(block) && asize <= csize);
+
     if ((csize - asize) >= min_block_size)
     {
         block_t *block_next;
-        write_header(block, asize, true);
-        write_footer(block, asize, true);
+        write_header(block, asize, true, get_prev_alloc(block));
 
         block_next = find_next(block);
-        write_header(block_next, csize-asize, false);
-        write_footer(block_next, csize-asize, false);
-    }
+        write_header(block_next, csize-asize, false, true);
+        write_footer(block_next, csize-asize);
+        set_prev_alloc(find_next(block_next), false);
 
-    else
-    {
-        write_header(block, csize, true);
-        write_footer(block, csize, true);
+        coalesce(block_next);
     }
 }
 
 /*
- * find_fit: Looks for a free block with at least asize bytes with
- *           first-fit policy. Returns NULL if none is found.
+ * find_fit: Looks for a free block with at least asize bytes, first in the
+ *           list of its size class, then at the head of the first non-empty
+ *           list of a larger class. Returns NULL if none is found.
  */
 static block_t *find_fit(size_t asize)
 {
     block_t *block;
+    int index = get_class(asize);
+    unsigned int map;
 
-    for (block = heap_listp; get_size(block) > 0;
-                             block = find_next(block))
+    // Every block of a single-size class fits
+    for (block = free_lists[index]; block != NULL; block = block->next)
     {
-
-        if (!(get_alloc(block)) && (asize <= get_size(block)))
+        if (asize <= get_size(block))
         {
             return block;
         }
     }
-    return NULL; // no fit found
+
+    // Every block of a larger class fits
+    map = class_map & ~((2u << index) - 1);
+    if (map == 0)
+    {
+        return NULL; // no fit found
+    }
+    return free_lists[__builtin_ctz(map)];
+}
+
+/*
+ * get_class: returns the index of the free list for blocks of a given size.
+ */
+static int get_class(size_t size)
+{
+    int index = NUM_EXACT_CLASSES;
+    size_t limit = 256;
+
+    if (size < min_block_size + NUM_EXACT_CLASSES * dsize)
+    {
+        return (size - min_block_size) / dsize;
+    }
+
+    while (size >= limit && index < NUM_CLASSES - 1)
+    {
+        index++;
+        limit *= 2;
+    }
+    return index;
+}
+
+/*
+ * insert_free: inserts a free block at the head of its free list.
+ */
+static void insert_free(block_t *block)
+{
+    int index = get_class(get_size(block));
+
+    block->prev = NULL;
+    block->next = free_lists[index];
+    if (block->next != NULL)
+    {
+        block->next->prev = block;
+    }
+    free_lists[index] = block;
+    class_map |= 1u << index;
+}
+
+/*
+ * remove_free: unlinks a free block from its free list.
+ */
+static void remove_free(block_t *block)
+{
+    int index = get_class(get_size(block));
+
+    if (block->prev != NULL)
+    {
+        block->prev->next = block->next;
+    }
+    else
+    {
+        free_lists[index] = block->next;
+        if (block->next == NULL)
+        {
+            class_map &= ~(1u << index);
+        }
+    }
+
+    if (block->next != NULL)
+    {
+        block->next->prev = block->prev;
+    }
 }
 
 /*
@@ -480,13 +651,35 @@ static size_t round_up(size_t size, size_t n)
     return (n * ((size + (n-1)) / n));
 }
 
+/*
+ * adjust_size: returns the size of the block needed to hold a payload of
+ *              size bytes: the payload plus the header, rounded up to a
+ *              multiple of 16, and at least the minimum block size.
+ */
+static size_t adjust_size(size_t size)
+{
+    return max(round_up(size + wsize, dsize), min_block_size);
+}
+
 /*
  * pack: returns a header reflecting a specified size and its alloc status.
  *       If the block is allocated, the lowest bit is set to 1, and 0 otherwise.
+ *       If the previous block is allocated, the second lowest bit is set to
+ *       1, and 0 otherwise.
  */
-static word_t pack(size_t size, bool alloc)
+static word_t pack(size_t size, bool alloc, bool prev_alloc)
 {
-    return alloc ? (size | 1) : size;
+    word_t word = size;
+
+    if (alloc)
+    {
+        word |= alloc_mask;
+    }
+    if (prev_alloc)
+    {
+        word |= prev_alloc_mask;
+    }
+    return word;
 }
 
 
@@ -509,13 +702,13 @@ static size_t get_size(block_t *block)
 }
 
 /*
- * get_payload_size: returns the payload size of a given block, equal to
- *                   the entire block size minus the header and footer sizes.
+ * get_payload_size: returns the payload size of a given allocated block,
+ *                   equal to the entire block size minus the header size.
  */
 static size_t get_payload_size(block_t *block)
 {
     size_t asize = get_size(block);
-    return asize - dsize;
+    return asize - wsize;
 }
 
 /*
@@ -537,24 +730,50 @@ static bool get_alloc(block_t *block)
 }
 
 /*
- * write_header: given a block and its size and allocation status,
+ * get_prev_alloc: returns true when the previous block is allocated based on
+ *                 the block header's second lowest bit, and false otherwise.
+ */
+static bool get_prev_alloc(block_t *block)
+{
+    return (bool)(block->header & prev_alloc_mask);
+}
+
+/*
+ * set_prev_alloc: updates the second lowest bit of a block header to reflect
+ *                 the allocation status of the previous block.
+ */
+static void set_prev_alloc(block_t *block, bool prev_alloc)
+{
+    if (prev_alloc)
+    {
+        block->header |= prev_alloc_mask;
+    }
+    else
+    {
+        block->header &= ~prev_alloc_mask;
+    }
+}
+
+/*
+ * write_header: given a block and its size and allocation statuses,
  *               writes an appropriate value to the block header.
  */
-static void write_header(block_t *block, size_t size, bool alloc)
+static void write_header(block_t *block, size_t size, bool alloc,
+                         bool prev_alloc)
 {
-    block->header = pack(size, alloc);
+    block->header = pack(size, alloc, prev_alloc);
 }
 
 
 /*
- * write_footer: given a block and its size and allocation status,
- *               writes an appropriate value to the block footer by first
- *               computing the position of the footer.
+ * write_footer: given a free block and its size, writes an appropriate value
+ *               to the block footer by first computing the position of the
+ *               footer.
  */
-static void write_footer(block_t *block, size_t size, bool alloc)
+static void write_footer(block_t *block, size_t size)
 {
-    word_t *footerp = (word_t *)((block->payload) + get_size(block) - dsize);
-    *footerp = pack(size, alloc);
+    word_t *footerp = (word_t *)((block->payload) + size - dsize);
+    *footerp = pack(size, false, true);
 }
 
 
@@ -583,10 +802,11 @@ static word_t *find_prev_footer(block_t *block)
 /*
  * find_prev: returns the previous block position by checking the previous
  *            block's footer and calculating the start of the previous block
- *            based on its size.
+ *            based on its size. Requires that the previous block is free.
  */
 static block_t *find_prev(block_t *block)
 {
+    dbg_requires(!get_prev_alloc(block));
     word_t *footerp = find_prev_footer(block);
     size_t size = extract_size(*footerp);
     return (block_t *)((char *)block - size);
@@ -609,7 +829,7 @@ static void *header_to_payload(block_t *block)
 {
     return (void *)(block->payload);
 }
- 
+
 /* mm_checkheap: checks the heap for correctness; returns true if
  *               the heap is correct, and false otherwise.
  *               can call this function using mm_checkheap(__LINE__);
@@ -617,21 +837,84 @@ static void *header_to_payload(block_t *block)
  */
 bool mm_checkheap(int lineno)
 {
-    if (heap_listp != NULL)
+    block_t *block;
+    size_t nb_free = 0;
+    bool prev_alloc = true;
+    int i;
+
+    if (heap_listp == NULL)
     {
-        // check prologue footer: size is 0 and prologue is allocated
-        word_t prologue_footer = *find_prev_footer(heap_listp);
-        assert(extract_size(prologue_footer) == 0 && extract_alloc(prologue_footer));
+        return true;
+    }
 
-        // check header-footer consistency
-        block_t *block = heap_listp;
-        if (get_size(block) != 0)
+    // check prologue footer: size is 0 and prologue is allocated
+    word_t prologue_footer = *find_prev_footer(heap_listp);
+    if (extract_size(prologue_footer) != 0 || !extract_alloc(prologue_footer))
+    {
+        printf("Bad prologue (line %d)\n", lineno);
+        return false;
+    }
+
+    // Walk the heap: blocks are aligned, the previous allocation bits are
+    // right, free blocks have a matching footer and are never adjacent
+    for (block = heap_listp; get_size(block) > 0; block = find_next(block))
+    {
+        if (((size_t)header_to_payload(block)) % dsize != 0 ||
+            get_size(block) < min_block_size ||
+            get_prev_alloc(block) != prev_alloc)
+        {
+            printf("Bad block %p (line %d)\n", (void *)block, lineno);
+            return false;
+        }
+        if (!get_alloc(block))
         {
-            word_t block_header = block->header;
-            word_t block_footer = *(find_prev_footer(find_next(heap_listp)));
-            assert(extract_size(block_header) == extract_size(block_footer));
-            assert(extract_alloc(block_header) == extract_alloc(block_footer));
+            word_t footer = *find_prev_footer(find_next(block));
+            if (!prev_alloc || extract_size(footer) != get_size(block))
+            {
+                printf("Bad free block %p (line %d)\n", (void *)block, lineno);
+                return false;
+            }
+            nb_free++;
         }
+        prev_alloc = get_alloc(block);
     }
+
+    // check epilogue header
+    if (!get_alloc(block) || get_prev_alloc(block) != prev_alloc)
+    {
+        printf("Bad epilogue (line %d)\n", lineno);
+        return false;
+    }
+
+    // Walk the free lists: links are consistent, blocks are free and in the
+    // right class, and every free block is in a list
+    for (i = 0; i < NUM_CLASSES; i++)
+    {
+        block_t *prev = NULL;
+
+        if ((free_lists[i] != NULL) != ((class_map >> i) & 1))
+        {
+            printf("Bad class map for list %d (line %d)\n", i, lineno);
+            return false;
+        }
+        for (block = free_lists[i]; block != NULL; block = block->next)
+        {
+            if (block->prev != prev || get_alloc(block) ||
+                get_class(get_size(block)) != i)
+            {
+                printf("Bad list entry %p (line %d)\n", (void *)block, lineno);
+                return false;
+            }
+            prev = block;
+            nb_free--;
+        }
+    }
+
+    if (nb_free != 0)
+    {
+        printf("Free blocks missing from the lists (line %d)\n", lineno);
+        return false;
+    }
+
     return true;
 }
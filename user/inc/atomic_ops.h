@@ -16,4 +16,15 @@
  */
 int atomic_exchange(int *mutex_lock, int val);
 
+/** @brief Stores the third parameter at the address pointed to by the first
+ *   parameter if the value there is equal to the second parameter, atomically
+ *  @param addr The pointer to the value to be compared and replaced
+ *  @param expected The value *addr must be equal to for the store to happen
+ *  @param val The value to store at addr
+ *
+ *  @return The previous value at the address specified in the first
+ *   parameter, which is equal to expected if and only if val was stored
+ */
+int atomic_compare_and_swap(int *addr, int expected, int val);
+
 #endif /* _ATOMIC_OPS_H */
@@ -6,7 +6,8 @@
 #ifndef _COND_TYPE_H
 #define _COND_TYPE_H
 
-#include <queue.h>
+#include <waiter.h>
+#include <spinlock.h>
 #include <mutex_type.h>
 
 /** A structure of a condition variable
@@ -19,10 +20,19 @@ typedef struct cond {
    */
   int init;
 
-  /** @brief A generic_queue_t type member which is used to store the
-   *   the TIDs of all the thread waiting for this condition variable
+  /** @brief The first thread waiting on this condition variable. The waiter_t
+   *   records live on the waiting threads' stacks, so waiting on a condition
+   *   variable never allocates memory
    */
-  generic_queue_t waiting_queue;
+  waiter_t *head;
+
+  /** @brief The last thread waiting on this condition variable
+   */
+  waiter_t *tail;
+
+  /** @brief A spinlock protecting the list of waiting threads
+   */
+  spinlock_t waiters_lock;
 } cond_t;
 
 #endif /* _COND_TYPE_H */
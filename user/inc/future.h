@@ -0,0 +1,90 @@
+/** @file future.h
+ *  @brief This file declares the future structure, a value which is given
+ *   once by a producer and can be waited on, polled or chained by consumers,
+ *   as well as functions to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _FUTURE_H
+#define _FUTURE_H
+
+#include <spinlock.h>
+#include <waiter.h>
+#include <task_pool.h>
+
+/** @brief A structure that represents a function called with the value of a
+ *   future once it is fulfilled. It belongs to the caller of future_then(),
+ *   which must keep it around until the function was called
+ */
+typedef struct future_continuation {
+
+  /** @brief The function called with the future's value and arg
+   */
+  void (*func)(void *value, void *arg);
+
+  /** @brief The second argument given to the function
+   */
+  void *arg;
+
+  /** @brief The next continuation of the future
+   */
+  struct future_continuation *next;
+
+} future_continuation_t;
+
+/** @brief A structure that represents a future
+ */
+typedef struct future {
+
+  /** @brief Whether the future was fulfilled
+   */
+  volatile int state;
+
+  /** @brief The value of the future, once it is fulfilled
+   */
+  void *value;
+
+  /** @brief The threads waiting for the future to be fulfilled
+   */
+  waiter_t *waiters;
+
+  /** @brief The continuations to call once the future is fulfilled, the
+   *   latest registered first
+   */
+  future_continuation_t *continuations;
+
+  /** @brief A spinlock protecting the future
+   */
+  spinlock_t lock;
+
+  /** @brief The pool whose worker fulfills the future, if it was given to
+   *   future_spawn()
+   */
+  task_pool_t *pool;
+
+  /** @brief The function whose return value fulfills the future, if it was
+   *   given to future_spawn()
+   */
+  void *(*func)(void *);
+
+  /** @brief The argument given to the function
+   */
+  void *arg;
+
+  /** @brief The pool task running the function
+   */
+  pool_task_t task;
+
+} future_t;
+
+int future_init(future_t *future);
+void future_destroy(future_t *future);
+int future_fulfill(future_t *future, void *value);
+void future_spawn(task_pool_t *pool, future_t *future,
+                  void *(*func)(void *), void *arg);
+int future_wait(future_t *future, void **valuep);
+int future_poll(future_t *future, void **valuep);
+void future_then(future_t *future, future_continuation_t *continuation,
+                 void (*func)(void *value, void *arg), void *arg);
+
+#endif /* _FUTURE_H */
@@ -21,4 +21,7 @@ typedef struct generic_node {
   struct generic_node *next;
 } generic_node_t;
 
+generic_node_t *generic_node_alloc(void *value);
+void generic_node_free(generic_node_t *node);
+
 #endif /* _GENERIC_NODE_H */
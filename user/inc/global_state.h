@@ -9,8 +9,21 @@
 
 #include <mutex.h>
 #include <cond_type.h>
+#include <stack_pool.h>
+#include <thr_specific.h>
+#include <task_pool.h>
+#include <future.h>
+#include <rwlock_policy.h>
+#include <rwlock_upgrade.h>
+#include <seqlock.h>
+#include <thr_waitset.h>
+#include <thr_detach.h>
+#include <thr_create_n.h>
+#include <thr_create_sized.h>
 #include <syscall.h>
-#include <hash_table.h>
+#include <tcb_directory.h>
+#include <thread_cache.h>
+#include <slab.h>
 
 /** @brief State of a thread which means that a thread has joined this thread
  */
@@ -40,13 +53,18 @@ typedef struct tcb {
   /** @brief Highest address of thread's stack space
    */ 
   unsigned int *stack_high;
+  /** @brief Batch of stacks the thread's stack belongs to (NULL for the root
+   *   thread)
+   */
+  stack_region_t *stack_batch;
   /** @brief Thread's return status
    */ 
   void* return_status;
 
 
-  /* library_tid, stack_low and stack_high do not need to be protected by a
-   * lock since their value is defined before the thread is created.
+  /* library_tid, stack_low, stack_high and stack_batch do not need to be
+   * protected by a lock since their value is defined before the thread is
+   * created.
    *
    * return_status is written to only by the thread owning this TCB, so
    * no lock is needed for it neither. */
@@ -74,6 +92,64 @@ typedef struct tcb {
   /** @brief Mutex for manipulating the thread's state field
    */
   mutex_t mutex_state;
+  /** @brief The waitset the thread belongs to, NULL if it does not belong
+   *   to any (protected by mutex_state)
+   */
+  struct thr_waitset *waitset;
+  /** @brief Whether the thread was detached (protected by mutex_state)
+   */
+  int detached;
+  /** @brief The next exited thread in the waitset's list of exited threads
+   *   (protected by the waitset's mutex), or in the task's list of exited
+   *   detached threads (protected by the list's spinlock)
+   */
+  struct tcb *waitset_next;
+
+  /*------------------------------*/
+
+  /** @brief Number of threads still using the TCB and the thread's stack.
+   *   The thread itself holds a pin until the last instruction it runs
+   *   before vanishing, and the thread creating it holds one until it has
+   *   set kernel_tid. The TCB and stack are only reclaimed once the count
+   *   drops to 0 (updated with atomic operations)
+   */
+  volatile int pins;
+
+  /*------------------------------*/
+
+  /** @brief The reader biased locks the thread holds for reading without
+   *   having updated their lock word, NULL for unused entries. Only written
+   *   by the thread owning the TCB, and read by writers revoking the bias of
+   *   a lock (see rwlock.c)
+   */
+  struct rwlock * volatile biased_reads[RWLOCK_BIASED_READS];
+
+  /*------------------------------*/
+
+  /** @brief Thread's cache of free memory blocks (only used by the thread
+   *   owning the TCB)
+   */
+  thread_cache_t cache;
+
+  /** @brief Thread's magazines of free objects for the slab caches (only
+   *   used by the thread owning the TCB)
+   */
+  slab_magazine_t magazines[SLAB_MAX_CACHES];
+
+  /** @brief Thread's values for the first thread-specific data keys (only
+   *   used by the thread owning the TCB)
+   */
+  thr_specific_value_t specific[THR_SPECIFIC_INLINE];
+
+  /** @brief Thread's values for the other keys, NULL until one of them is
+   *   set
+   */
+  thr_specific_value_t *specific_spill;
+
+  /** @brief The task pool worker run by the thread, NULL if it is not a
+   *   worker (only used by the thread owning the TCB)
+   */
+  task_pool_worker_t *pool_worker;
 
 } tcb_t;
 
@@ -90,32 +166,58 @@ typedef struct task {
   /** @brief Highest address for (grand)child threads of first thread
    */
   unsigned int* stack_highest_childs;
+  /** @brief Size of each thread's stack space minus one if the stack spaces
+   *   are aligned power-of-two sized regions (see thr_init_aligned()), 0
+   *   otherwise
+   */
+  unsigned int stack_mask;
 
   /* The above fields do not need to be protected by a lock since
    * their value does not change after thr_init() has returned */
   /*------------------------------*/
 
   /** @brief Lowest address of task's threads stacks(initialized by autostack())
+   *   Protected by the stack pool's mutex once thr_init() has returned
    */
   unsigned int *stack_lowest;
-  /** @brief Thread library tids
-   */
-  unsigned int tid;
-  /** @brief Spinlock for task's state access
-   */
-  mutex_t state_lock;
 
   /*------------------------------*/
 
-  /** @brief Queue for free stack spaces
+  /** @brief Pool of free stack spaces
    */
-  generic_queue_t stack_queue;
+  stack_pool_t stacks;
 
   /*------------------------------*/
 
-  /** @brief Data structure holding the TCB of all threads in the task
+  /** @brief Data structure holding the TCB of all threads in the task,
+   *   indexed by library TID
+   */
+  tcb_directory_t tcbs;
+
+  /** @brief Slab cache the TCBs are allocated from
+   */
+  slab_cache_t tcb_cache;
+
+  /** @brief Map from the slots of the stack region to the TCB of the thread
+   *   whose stack spans them, for threads created by thr_create_sized()
+   *   whose stack spans several slots
+   */
+  tcb_directory_t stack_slots;
+
+  /** @brief Number of threads whose stack spans several slots and which
+   *   were not joined yet. get_tcb() only looks at stack_slots when it is
+   *   not 0
+   */
+  volatile int sized_stacks;
+
+  /** @brief Detached threads which have exited, and whose TCB and stack are
+   *   reclaimed once they have vanished
+   */
+  tcb_t *detached_exited;
+
+  /** @brief Spinlock protecting the list of exited detached threads
    */
-  generic_hash_table_t tcbs;
+  spinlock_t detached_lock;
 
   /*------------------------------*/
 
@@ -7,38 +7,75 @@
 #ifndef _HASH_TABLE_H
 #define _HASH_TABLE_H
 
-#include <linked_list.h>
 #include <mutex_type.h>
 
+/** @brief A structure that represents one slot of a hash table. The key is
+ *   stored inline so that probing never follows a pointer
+ */
+typedef struct hash_table_entry {
+
+  /** @brief The element's key
+   */
+  unsigned int key;
+
+  /** @brief The element, NULL if the slot is empty
+   */
+  void *value;
+
+} hash_table_entry_t;
+
 /** @brief A structure that represents a hash table
+ *
+ *  The hash table uses open addressing with linear probing. Elements are
+ *  deleted by shifting the following elements of their cluster backwards,
+ *  so the table never contains tombstones. When the table gets too full, a
+ *  table twice as large is allocated and the elements of the old table are
+ *  moved a few at a time by each subsequent operation, so that no single
+ *  operation pays for rehashing the whole table.
  */
 typedef struct hash_table {
 
-  /** @brief A pointer to generic_linked_list_t type which will be used as an
-   *   array where each memeber forms a bucket for this hash table
+  /** @brief The current table, new elements are always inserted in it
+   */
+  hash_table_entry_t *entries;
+
+  /** @brief The number of slots in the current table (a power of two)
+   */
+  unsigned int capacity;
+
+  /** @brief The number of elements in the current table
+   */
+  unsigned int nb_elements;
+
+  /** @brief The table being rehashed in the current one, NULL if none
+   */
+  hash_table_entry_t *old_entries;
+
+  /** @brief The number of slots in the table being rehashed
    */
-  generic_linked_list_t *buckets;
+  unsigned int old_capacity;
 
-  /** @brief An unsigned storing the number of buckets for this hash table
+  /** @brief The number of elements left in the table being rehashed
    */
-  unsigned int nb_buckets;
+  unsigned int old_nb_elements;
 
-  /** @brief A function pointer to the hash function for this hash table
+  /** @brief The next slot of the old table to move to the current one
    */
-  unsigned int (*hash_function)(void *elem, unsigned int nb_buckets);
+  unsigned int rehash_index;
 
-  /** @brief A function pointer to the function to find an element in the
-   *   hash table
+  /** @brief A mutex to guarantee atomic access to the hash table
    */
-  int (*find)(void *elem, void *value);
+  mutex_t mp;
 
 } generic_hash_table_t;
 
-int hash_table_init(generic_hash_table_t *hash_table, unsigned int nb_buckets,
-                    int (*find)(void *, void *),
-                    unsigned int (*hash_function)(void *, unsigned int));
-int hash_table_add_element(generic_hash_table_t *hash_table, void *elem);
-void *hash_table_remove_element(generic_hash_table_t *hash_table, void *elem);
-void *hash_table_get_element(generic_hash_table_t *hash_table, void *elem);
+int hash_table_init(generic_hash_table_t *hash_table, unsigned int capacity);
+int hash_table_add_element(generic_hash_table_t *hash_table, unsigned int key,
+                           void *elem);
+void *hash_table_remove_element(generic_hash_table_t *hash_table,
+                                unsigned int key);
+void *hash_table_get_element(generic_hash_table_t *hash_table,
+                             unsigned int key);
+void hash_table_destroy(generic_hash_table_t *hash_table);
 
 #endif /* _HASH_TABLE_H */
@@ -6,12 +6,21 @@
 #ifndef _MUTEX_TYPE_H
 #define _MUTEX_TYPE_H
 
+#include <spinlock.h>
+#include <waiter.h>
+
+/** @brief Number of slots in a mutex's ring of ticket holders' kernel tids
+ */
+#define MUTEX_TID_RING_SIZE 8
+
 /** @brief The structure of a mutex
  */
 typedef struct mutex {
 
-  /** @brief An int which stores the ticket number of the thread which ran last
-   */ 
+  /** @brief An int which stores the ticket number of the thread which ran
+   *   last. Tickets are even, the lowest bit is set when the thread holding
+   *   the ticket after the owner's is descheduled and must be woken up
+   */
   int prev;
 
   /** @brief An int which stores the ticket number which should be given to the
@@ -22,6 +31,25 @@ typedef struct mutex {
   /** @brief An int which stores whether the miutex has been initialized or not
    */
   int init;
+
+  /** @brief The kernel tids of the threads holding the most recent tickets,
+   *   indexed by ticket modulo MUTEX_TID_RING_SIZE (-1 for an empty slot).
+   *   A waiter which is done spinning uses it to yield directly to the
+   *   owner, as long as fewer than MUTEX_TID_RING_SIZE tickets separate
+   *   them. The unlocking thread does not need it: it only yields to a next
+   *   owner which descheduled itself, whose tid is on the waiters list.
+   *   Waiting for the waiters spinlock still falls back to yield(-1)
+   */
+  int ticket_tids[MUTEX_TID_RING_SIZE];
+
+  /** @brief A list of the threads which stopped spinning and descheduled
+   *   themselves while waiting for their ticket to be served
+   */
+  waiter_t *waiters;
+
+  /** @brief A spinlock protecting the waiters list
+   */
+  spinlock_t waiters_lock;
 } mutex_t;
 
 #endif /* _MUTEX_TYPE_H */
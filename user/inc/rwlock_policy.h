@@ -0,0 +1,44 @@
+/** @file rwlock_policy.h
+ *  @brief This file declares the policies a reader writer lock can use to
+ *   order waiting readers and writers, as well as a function to choose one.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _RWLOCK_POLICY_H
+#define _RWLOCK_POLICY_H
+
+#include <rwlock_type.h>
+
+/** @brief Policy of a reader writer lock giving priority to the writers. No
+ *   reader takes the lock while a writer is waiting, which may starve the
+ *   readers. This is the default policy
+ */
+#define RWLOCK_WRITER_PREFERRING 0
+
+/** @brief Policy of a reader writer lock alternating between read and write
+ *   phases. New readers wait behind waiting writers, but the readers which
+ *   were waiting when a writer releases the lock take it before the next
+ *   writer does, so that neither readers nor writers starve
+ */
+#define RWLOCK_PHASE_FAIR 1
+
+/** @brief Flag of a reader writer lock policy making readers mark an entry
+ *   of their own TCB, instead of updating the shared lock word, so that
+ *   concurrent readers do not write to the same cache line. Writers then
+ *   have to scan the TCBs of every thread, and turn the flag off for a while,
+ *   hence it only suits locks which are rarely taken for writing.
+ *
+ *   A thread falls back to the shared lock word when it already holds
+ *   RWLOCK_BIASED_READS reader biased locks for reading this way, when the
+ *   lock's bias is off, and before thr_init() was called
+ */
+#define RWLOCK_READER_BIASED 2
+
+/** @brief Number of reader biased locks a thread can hold for reading at the
+ *   same time without updating their lock word
+ */
+#define RWLOCK_BIASED_READS 4
+
+int rwlock_set_policy(rwlock_t *rwlock, int policy);
+
+#endif /* _RWLOCK_POLICY_H */
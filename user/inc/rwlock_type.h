@@ -13,32 +13,67 @@
  */
 typedef struct rwlock {
 
-  /** @brief An int storing the number of threads waiting to acquire the
-   *   read lock
+  /** @brief The lock word. It packs the number of threads which currently
+   *   have the read lock, whether a thread has the write lock, whether a
+   *   thread has the upgradable read lock and whether threads are waiting
+   *   in the slow path. Uncontended lock and unlock
+   *   operations only update this word, with a single atomic instruction
    */
-  int waiting_readers;
+  volatile int state;
 
-  /** @brief An int storing the number of threads which currently have the
+  /** @brief An int storing the number of threads waiting to acquire the
    *   read lock
    */
-  int active_readers;
+  int waiting_readers;
 
   /** @brief An int storing the number of threads waiting to acquire the
    *   write lock
    */
   int waiting_writers;
 
-  /** @brief An int storing the number of threads which currently have the
-   *   write lock
+  /** @brief An int storing the number of threads waiting to acquire the
+   *   upgradable read lock
+   */
+  int waiting_upgraders;
+
+  /** @brief Whether the thread holding the upgradable read lock is waiting
+   *   for the readers to leave in order to upgrade it to the write lock
+   */
+  int upgrade_pending;
+
+  /** @brief The library tid of the thread holding the upgradable read lock,
+   *   -1 if none
    */
-  int active_writers;
+  volatile int upgrader;
 
-  /** @brief An int storing the current operation being performed by threads 
-   *   holding this lock. It can be RWLOCK_READ when they are reading,
-   *   RWLOCK_WRITE when they are writing or RWLOCK_INVALID if no lock has 
-   *   been acquired yet 
+  /** @brief An int storing the number of waiting readers which may still
+   *   take the read lock ahead of the waiting writers, under the
+   *   RWLOCK_PHASE_FAIR policy
    */
-  int curr_op;
+  int reader_grant;
+
+  /** @brief An int incremented whenever a read phase starts. The readers
+   *   which were waiting when it was incremented are the ones counted in
+   *   reader_grant
+   */
+  int read_phase;
+
+  /** @brief An int storing the policy of the lock. It can be
+   *   RWLOCK_WRITER_PREFERRING or RWLOCK_PHASE_FAIR, possibly combined with
+   *   RWLOCK_READER_BIASED
+   */
+  int policy;
+
+  /** @brief Whether readers may take the lock by marking an entry of their
+   *   TCB instead of updating the lock word, under the RWLOCK_READER_BIASED
+   *   policy. It is cleared by writers and set again by readers
+   */
+  volatile int reader_bias;
+
+  /** @brief The number of read locks to take through the lock word before
+   *   readers set reader_bias again
+   */
+  int bias_inhibit;
 
   /** @brief An int which stores the current state of the rwlock. It can be
    *   RWLOCK_INITIALIZED when the lock has been initialized, or 
@@ -46,13 +81,13 @@ typedef struct rwlock {
    */
   int init;
 
-  /** @brief A mutex for this read write lock to ensure atomicity and mutual
-   *   exclusion amongst the various rwlock functions
+  /** @brief A mutex for this read write lock protecting the slow path, i.e.
+   *   the waiting threads' bookkeeping
    */ 
   mutex_t lock;
 
   /** @brief A condition variable for the threads which want to take a read 
-   *   lock
+   *   lock or the upgradable read lock
    */
   cond_t read_cvar;
 
@@ -61,6 +96,11 @@ typedef struct rwlock {
    */
   cond_t write_cvar;
 
+  /** @brief A condition variable for the thread which wants to upgrade its
+   *   upgradable read lock to the write lock
+   */
+  cond_t upgrade_cvar;
+
 } rwlock_t;
 
 #endif /* _RWLOCK_TYPE_H */
@@ -0,0 +1,20 @@
+/** @file rwlock_upgrade.h
+ *  @brief This file declares the upgradable read mode of reader writer locks,
+ *   which lets a reader turn into a writer without releasing the lock.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _RWLOCK_UPGRADE_H
+#define _RWLOCK_UPGRADE_H
+
+#include <rwlock_type.h>
+
+/** @brief Type of lock given to rwlock_lock() to take the upgradable read
+ *   lock. It is held by at most one thread at a time, alongside the readers,
+ *   and is released with rwlock_unlock() or upgraded with rwlock_upgrade()
+ */
+#define RWLOCK_UPGRADABLE 2
+
+void rwlock_upgrade(rwlock_t *rwlock);
+
+#endif /* _RWLOCK_UPGRADE_H */
@@ -5,8 +5,8 @@
 #ifndef _SEM_TYPE_H
 #define _SEM_TYPE_H
 
-#include <cond_type.h>
-#include <mutex_type.h>
+#include <spinlock.h>
+#include <waiter.h>
 
 /** @brief A structure of a semaphore
  */
@@ -18,27 +18,31 @@ typedef struct sem {
    */
   int init;
 
-  /** @brief An int storing the number of threads that have been made woken up
-   *   by the semaphore but haven't started executing yet
-   */
-  int wokenup_waiting;
-
   /** @brief An int storing the number of resources available for this 
    *   semaphore which also means it is the maximum number of threads 
-   *   which can run in paralled while holding this semaphore
+   *   which can run in paralled while holding this semaphore. When it is
+   *   negative, its opposite is the number of threads waiting for a
+   *   resource. It is only updated with atomic instructions
+   */
+  volatile int available_resources;
+
+  /** @brief An int storing the number of resources handed over by
+   *   sem_signal to waiting threads which were not on the list of waiting
+   *   threads yet
+   */
+  int handoffs;
+
+  /** @brief The first thread waiting for a resource
    */
-  int available_resources;
+  waiter_t *head;
 
-  /** @brief A condition variable that waits for the state to change so that
-   *   a thread can run if the number of available resources becomes greater
-   *   than zero
+  /** @brief The last thread waiting for a resource
    */
-  cond_t cvar;
+  waiter_t *tail;
 
-  /** @brief A mutex which ensures atomicity and mutual exclusion amongst the
-   *   various semapahore functions
+  /** @brief A spinlock protecting the list of waiting threads and handoffs
    */
-  mutex_t lock;
+  spinlock_t waiters_lock;
 
 } sem_t;
 
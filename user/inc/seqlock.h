@@ -0,0 +1,35 @@
+/** @file seqlock.h
+ *  @brief This file declares the sequence lock structure, which protects
+ *   small records that are read much more often than they are written
+ *   without readers writing to shared memory, as well as functions to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _SEQLOCK_H
+#define _SEQLOCK_H
+
+#include <mutex_type.h>
+
+/** @brief A structure that represents a sequence lock
+ */
+typedef struct seqlock {
+
+  /** @brief Incremented before and after every write, so that it is odd
+   *   while a writer is modifying the record
+   */
+  volatile unsigned int sequence;
+
+  /** @brief A mutex serializing the writers
+   */
+  mutex_t write_lock;
+
+} seqlock_t;
+
+int seqlock_init(seqlock_t *seqlock);
+void seqlock_destroy(seqlock_t *seqlock);
+void seqlock_write_lock(seqlock_t *seqlock);
+void seqlock_write_unlock(seqlock_t *seqlock);
+unsigned int seqlock_read_begin(seqlock_t *seqlock);
+int seqlock_read_retry(seqlock_t *seqlock, unsigned int sequence);
+
+#endif /* _SEQLOCK_H */
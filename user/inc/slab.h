@@ -0,0 +1,70 @@
+/** @file slab.h
+ *  @brief This file declares the slab cache structure used to allocate the
+ *   thread library's fixed-size objects, as well as functions to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stddef.h>
+#include <mutex_type.h>
+
+/** @brief Maximum number of slab caches which get per-thread magazines
+ */
+#define SLAB_MAX_CACHES 4
+
+/** @brief A structure that represents a thread's magazine for a slab cache:
+ *   a list of free objects, linked through their first word, which only the
+ *   thread owning the magazine touches
+ */
+typedef struct slab_magazine {
+
+  /** @brief The list of free objects
+   */
+  void *objects;
+
+  /** @brief The number of objects in the list
+   */
+  int nb_objects;
+
+} slab_magazine_t;
+
+/** @brief A structure that represents a cache of objects of the same size.
+ *   Objects are carved out of slabs holding many of them, and free objects
+ *   are kept in the cache (the depot) or in the threads' magazines instead of
+ *   being given back to the heap.
+ */
+typedef struct slab_cache {
+
+  /** @brief Size of the objects (rounded up to keep them aligned)
+   */
+  size_t object_size;
+
+  /** @brief Number of objects in a slab
+   */
+  int objects_per_slab;
+
+  /** @brief Index of the cache's magazine in the threads' TCB, -1 if the
+   *   cache has no magazines
+   */
+  int id;
+
+  /** @brief The depot: list of free objects shared by all threads, linked
+   *   through their first word
+   */
+  void *free_objects;
+
+  /** @brief A mutex protecting the depot
+   */
+  mutex_t mp;
+
+} slab_cache_t;
+
+int slab_cache_init(slab_cache_t *cache, size_t object_size);
+void *slab_alloc(slab_cache_t *cache);
+void slab_free(slab_cache_t *cache, void *object);
+void slab_magazines_init(slab_magazine_t *magazines);
+void slab_magazines_flush(slab_magazine_t *magazines);
+
+#endif /* _SLAB_H */
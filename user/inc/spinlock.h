@@ -0,0 +1,26 @@
+/** @file spinlock.h
+ *  @brief This file declares the spinlock structure as well as functions to
+ *   use it. Spinlocks protect the short internal critical sections of the
+ *   thread library (waiter lists) which can not use a mutex themselves.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+/** @brief A structure that represents a spinlock
+ */
+typedef struct spinlock {
+
+  /** @brief An int which is SPINLOCK_LOCKED when the lock is held and
+   *   SPINLOCK_UNLOCKED otherwise
+   */
+  int locked;
+
+} spinlock_t;
+
+int spinlock_init(spinlock_t *lock);
+void spinlock_lock(spinlock_t *lock);
+void spinlock_unlock(spinlock_t *lock);
+
+#endif /* _SPINLOCK_H */
@@ -0,0 +1,130 @@
+/** @file stack_pool.h
+ *  @brief This file declares the pool of thread stacks as well as functions
+ *   to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _STACK_POOL_H
+#define _STACK_POOL_H
+
+#include <mutex_type.h>
+
+/** @brief Default low watermark of the stack pool
+ */
+#define STACK_POOL_LOW_WATERMARK 0
+
+/** @brief Default high watermark of the stack pool. Stacks are mapped one at
+ *   a time by default, since every stack of a batch but the lowest one loses
+ *   its guard page
+ */
+#define STACK_POOL_HIGH_WATERMARK 0
+
+/** @brief Default number of free stacks above which the pool unmaps batches
+ *   of stacks
+ */
+#define STACK_POOL_TRIM_LIMIT 64
+
+/** @brief A structure that represents a range of the stack region: either a
+ *   batch of stacks mapped with a single new_pages() call, or a range which
+ *   is not mapped (a hole)
+ */
+typedef struct stack_region {
+
+  /** @brief Lowest address of the range
+   */
+  unsigned int base;
+
+  /** @brief Highest address of the range (excluded)
+   */
+  unsigned int top;
+
+  /** @brief Number of stacks in the batch
+   */
+  int nb_stacks;
+
+  /** @brief Number of free stacks in the batch
+   */
+  int nb_free;
+
+  /** @brief Number of slots spanned by the single stack of a batch mapped by
+   *   stack_pool_get_sized(), 0 for a batch of regular stacks
+   */
+  int nb_slots;
+
+  /** @brief The list of free stacks of the batch, identified by their
+   *   highest address and linked through the lowest word of their exception
+   *   stack
+   */
+  unsigned int *free_stacks;
+
+  /** @brief The previous batch in the pool's list of batches with free
+   *   stacks
+   */
+  struct stack_region *prev;
+
+  /** @brief The next batch in the pool's list of batches with free stacks,
+   *   or the next hole by increasing address
+   */
+  struct stack_region *next;
+
+} stack_region_t;
+
+/** @brief A structure that represents the pool of free thread stacks
+ *
+ *  Batches holding free stacks are kept in a list ordered by the last time a
+ *  stack was put back in them, so the stack handed out is the one which was
+ *  freed last, and is the most likely to still be in the caches.
+ */
+typedef struct stack_pool {
+
+  /** @brief The batch where a stack was put back most recently
+   */
+  stack_region_t *head;
+
+  /** @brief The batch where a stack was put back least recently
+   */
+  stack_region_t *tail;
+
+  /** @brief The ranges of the stack region which are not mapped, by
+   *   increasing address
+   */
+  stack_region_t *holes;
+
+  /** @brief The number of free stacks in the pool
+   */
+  int nb_free;
+
+  /** @brief When a thread creation leaves fewer free stacks than this, new
+   *   stacks are mapped
+   */
+  int low_watermark;
+
+  /** @brief Number of free stacks the pool is refilled up to when new stacks
+   *   are mapped (at least one stack is always mapped)
+   */
+  int high_watermark;
+
+  /** @brief When there are more free stacks than this (and than the high
+   *   watermark), batches of free stacks are unmapped
+   */
+  int trim_limit;
+
+  /** @brief A mutex protecting the pool, and task.stack_lowest
+   */
+  mutex_t mp;
+
+} stack_pool_t;
+
+int stack_pool_init(stack_pool_t *pool);
+unsigned int *stack_pool_get(stack_pool_t *pool, stack_region_t **batch);
+int stack_pool_get_n(stack_pool_t *pool, int nb, unsigned int **stacks,
+                     stack_region_t **batches);
+unsigned int *stack_pool_get_sized(stack_pool_t *pool, int nb_slots,
+                                   stack_region_t **batch);
+void stack_pool_put(stack_pool_t *pool, unsigned int *stack_high,
+                    stack_region_t *batch);
+int thr_stack_watermarks(int low_watermark, int high_watermark);
+int thr_stack_trim_limit(int trim_limit);
+int thr_init_aligned(unsigned int size);
+
+#endif /* _STACK_POOL_H */
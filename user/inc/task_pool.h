@@ -0,0 +1,145 @@
+/** @file task_pool.h
+ *  @brief This file declares the work-stealing task pool as well as functions
+ *   to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _TASK_POOL_H
+#define _TASK_POOL_H
+
+#include <spinlock.h>
+#include <waiter.h>
+
+/** @brief Number of tasks a worker's deque can hold (must be a power of two).
+ *   A task spawned on a full deque is run right away by the spawning thread
+ */
+#define TASK_POOL_DEQUE_SIZE 1024
+
+/** @brief A structure that represents a task run by a task pool. It belongs
+ *   to the caller of task_pool_submit() or task_pool_spawn(), which must keep
+ *   it around until task_pool_sync() returned for it, so running a task never
+ *   allocates memory
+ */
+typedef struct pool_task {
+
+  /** @brief The function run by the task
+   */
+  void *(*func)(void *);
+
+  /** @brief The argument given to the function
+   */
+  void *arg;
+
+  /** @brief The value returned by the function
+   */
+  void *result;
+
+  /** @brief Whether the task is pending, has a thread waiting on it, is
+   *   done, or is detached
+   */
+  volatile int state;
+
+  /** @brief The thread (which is not one of the pool's workers) waiting on
+   *   the task, if any
+   */
+  waiter_t *waiter;
+
+  /** @brief A spinlock the waiting thread takes once after waking up, so that
+   *   the worker's make_runnable() call can not wake it up later
+   */
+  spinlock_t lock;
+
+  /** @brief The next task in the pool's queue of submitted tasks
+   */
+  struct pool_task *next;
+
+} pool_task_t;
+
+/** @brief A structure that represents a worker of a task pool, and the
+ *   Chase-Lev deque of tasks it owns. The worker pushes and pops tasks at the
+ *   bottom of its deque, while idle workers steal tasks from its top
+ */
+typedef struct task_pool_worker {
+
+  /** @brief The pool the worker belongs to
+   */
+  struct task_pool *pool;
+
+  /** @brief The library tid of the worker thread
+   */
+  int tid;
+
+  /** @brief State of the random generator used to pick victims to steal from
+   */
+  unsigned int seed;
+
+  /** @brief Index of the oldest task in the deque, only incremented
+   */
+  volatile int top;
+
+  /** @brief Index following the newest task in the deque, only written by
+   *   the worker
+   */
+  volatile int bottom;
+
+  /** @brief The tasks of the deque, indexed modulo TASK_POOL_DEQUE_SIZE
+   */
+  pool_task_t * volatile tasks[TASK_POOL_DEQUE_SIZE];
+
+} task_pool_worker_t;
+
+/** @brief A structure that represents a fixed set of worker threads running
+ *   tasks
+ */
+typedef struct task_pool {
+
+  /** @brief The number of workers
+   */
+  int nb_workers;
+
+  /** @brief The workers
+   */
+  task_pool_worker_t *workers;
+
+  /** @brief The first task submitted by a thread which is not a worker
+   */
+  pool_task_t *submitted_head;
+
+  /** @brief The last task submitted by a thread which is not a worker
+   */
+  pool_task_t *submitted_tail;
+
+  /** @brief A spinlock protecting the queue of submitted tasks
+   */
+  spinlock_t submitted_lock;
+
+  /** @brief The list of idle workers which descheduled themselves
+   */
+  waiter_t *parked;
+
+  /** @brief The number of workers in the list of idle workers
+   */
+  int nb_parked;
+
+  /** @brief A spinlock protecting the list of idle workers
+   */
+  spinlock_t parked_lock;
+
+  /** @brief Set when the pool is destroyed, to make the workers exit
+   */
+  volatile int shutdown;
+
+} task_pool_t;
+
+int task_pool_init(task_pool_t *pool, int nb_workers);
+void task_pool_destroy(task_pool_t *pool);
+void task_pool_submit(task_pool_t *pool, pool_task_t *ptask,
+                      void *(*func)(void *), void *arg);
+void task_pool_spawn(task_pool_t *pool, pool_task_t *ptask,
+                     void *(*func)(void *), void *arg);
+void task_pool_spawn_detached(task_pool_t *pool, pool_task_t *ptask,
+                              void *(*func)(void *), void *arg);
+void *task_pool_sync(task_pool_t *pool, pool_task_t *ptask);
+int task_pool_run_one(task_pool_t *pool);
+
+#endif /* _TASK_POOL_H */
@@ -0,0 +1,115 @@
+/** @file tcb_directory.h
+ *  @brief This file declares the TCB directory structure as well as functions
+ *   to use it. The directory maps library issued TIDs to TCBs.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _TCB_DIRECTORY_H
+#define _TCB_DIRECTORY_H
+
+#include <mutex_type.h>
+
+/** @brief log2 of the number of slots in each chunk of the directory
+ */
+#define TCB_DIRECTORY_CHUNK_SHIFT 10
+
+/** @brief Number of slots in each chunk of the directory
+ */
+#define TCB_DIRECTORY_CHUNK_SIZE (1 << TCB_DIRECTORY_CHUNK_SHIFT)
+
+/** @brief log2 of the maximum number of chunks in the directory
+ */
+#define TCB_DIRECTORY_NB_CHUNKS_SHIFT 10
+
+/** @brief Maximum number of chunks in the directory (hence the directory
+ *   can hold TCB_DIRECTORY_NB_CHUNKS * TCB_DIRECTORY_CHUNK_SIZE threads)
+ */
+#define TCB_DIRECTORY_NB_CHUNKS (1 << TCB_DIRECTORY_NB_CHUNKS_SHIFT)
+
+/** @brief Number of low bits of a TID holding the index of its slot. The
+ *   other bits (but the sign bit) hold the slot's number of reuses, so that
+ *   a TID which was given back no longer refers to its slot once the slot's
+ *   TID is given out again
+ */
+#define TCB_DIRECTORY_INDEX_BITS \
+  (TCB_DIRECTORY_CHUNK_SHIFT + TCB_DIRECTORY_NB_CHUNKS_SHIFT)
+
+struct tcb;
+
+/** @brief A structure that represents one slot of the directory
+ */
+typedef struct tcb_directory_slot {
+
+  /** @brief The TCB of the thread whose library TID indexes this slot, or
+   *   NULL if there is no such thread
+   */
+  struct tcb *tcb;
+
+  /** @brief Incremented before and after every modification of the slot, so
+   *   that a reader can detect that it raced with a writer (it is odd while
+   *   the slot is being modified)
+   */
+  unsigned int generation;
+
+  /** @brief The number of times the slot's TID was given back. Its low bits
+   *   are part of the TIDs given out for the slot. Modified like tcb
+   */
+  unsigned int reuses;
+
+  /** @brief The index of the next slot in the directory's list of slots
+   *   whose TID can be given out again, while this slot is in the list
+   */
+  int next_free;
+
+} tcb_directory_slot_t;
+
+/** @brief A structure that represents a TCB directory
+ *
+ *  The directory is a dense array indexed by library TIDs, split in chunks
+ *  which are allocated the first time a TID falling in them is used. Chunks
+ *  are never moved nor freed, hence readers never need to take a lock.
+ *
+ *  The directory can also give out the TIDs indexing it. Slots whose TID is
+ *  given back are reused, oldest first, before any new slot, so the
+ *  directory never grows beyond the largest number of TIDs in use at the
+ *  same time. A TID given out again for a slot differs from the previous
+ *  ones in its high bits (see TCB_DIRECTORY_INDEX_BITS), so a stale TID
+ *  does not refer to the new thread, unless the slot was reused a multiple
+ *  of 2^(31 - TCB_DIRECTORY_INDEX_BITS) times in the meantime.
+ */
+typedef struct tcb_directory {
+
+  /** @brief The chunks of the directory (NULL if not allocated yet)
+   */
+  tcb_directory_slot_t *chunks[TCB_DIRECTORY_NB_CHUNKS];
+
+  /** @brief The lowest TID which was never given out
+   */
+  int next_tid;
+
+  /** @brief The index of the slot whose TID was given back first, -1 if
+   *   there is none
+   */
+  int free_head;
+
+  /** @brief The index of the slot whose TID was given back last, -1 if
+   *   there is none
+   */
+  int free_tail;
+
+  /** @brief A mutex serializing the allocation of new chunks and of TIDs
+   */
+  mutex_t grow_lock;
+
+} tcb_directory_t;
+
+int tcb_directory_init(tcb_directory_t *dir);
+int tcb_directory_add(tcb_directory_t *dir, int tid, struct tcb *tcb);
+struct tcb *tcb_directory_remove(tcb_directory_t *dir, int tid);
+struct tcb *tcb_directory_get(tcb_directory_t *dir, int tid);
+int tcb_directory_nb_slots(tcb_directory_t *dir);
+struct tcb *tcb_directory_get_at(tcb_directory_t *dir, int index);
+int tcb_directory_new_tids(tcb_directory_t *dir, int nb, int *tids);
+void tcb_directory_free_tid(tcb_directory_t *dir, int tid);
+
+#endif /* _TCB_DIRECTORY_H */
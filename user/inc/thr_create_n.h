@@ -0,0 +1,12 @@
+/** @file thr_create_n.h
+ *  @brief This file declares the function used to create several threads
+ *   with a single call.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _THR_CREATE_N_H
+#define _THR_CREATE_N_H
+
+int thr_create_n(int nb, void *(*func)(void *), void **args, int *tids);
+
+#endif /* _THR_CREATE_N_H */
@@ -0,0 +1,14 @@
+/** @file thr_create_sized.h
+ *  @brief This file declares the function used to create a thread with a
+ *   larger stack than the one given to thr_init(). Asking for a smaller
+ *   stack than the one given to thr_init() fails: the smallest stack size
+ *   used by the program must be the one given to thr_init().
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _THR_CREATE_SIZED_H
+#define _THR_CREATE_SIZED_H
+
+int thr_create_sized(void *(*func)(void *), void *arg, unsigned int size);
+
+#endif /* _THR_CREATE_SIZED_H */
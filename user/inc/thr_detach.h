@@ -0,0 +1,12 @@
+/** @file thr_detach.h
+ *  @brief This file declares the function used to detach a thread, so that
+ *   its resources are reclaimed without it being joined.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _THR_DETACH_H
+#define _THR_DETACH_H
+
+int thr_detach(int tid);
+
+#endif /* _THR_DETACH_H */
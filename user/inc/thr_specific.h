@@ -0,0 +1,56 @@
+/** @file thr_specific.h
+ *  @brief This file declares the thread-specific data interface: keys
+ *   created once for the whole task, for which every thread stores its own
+ *   value.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _THR_SPECIFIC_H
+#define _THR_SPECIFIC_H
+
+/** @brief log2 of the maximum number of keys existing at the same time
+ */
+#define THR_KEYS_SHIFT 7
+
+/** @brief Maximum number of keys existing at the same time in a task (the
+ *   slots of deleted keys are reused by the keys created later)
+ */
+#define THR_KEYS_MAX (1 << THR_KEYS_SHIFT)
+
+/** @brief Number of keys whose values are stored directly in the TCB. The
+ *   values of the other keys are stored in a table allocated the first time
+ *   a thread sets one of them
+ */
+#define THR_SPECIFIC_INLINE 8
+
+/** @brief Number of times the destructors are run when a thread exits, in
+ *   case destructors set new values
+ */
+#define THR_DESTRUCTOR_ITERATIONS 4
+
+/** @brief A key for thread-specific data: the index of the key's slot in
+ *   its low THR_KEYS_SHIFT bits, and the slot's generation above them
+ */
+typedef int thr_key_t;
+
+/** @brief A structure that represents a thread's value for a key
+ */
+typedef struct thr_specific_value {
+
+  /** @brief The value
+   */
+  void *value;
+
+  /** @brief The key the value was set for, so that a value set for a deleted
+   *   key is not seen through a key created later in the same slot
+   */
+  thr_key_t key;
+
+} thr_specific_value_t;
+
+int thr_key_create(thr_key_t *key, void (*destructor)(void *));
+int thr_key_delete(thr_key_t key);
+void *thr_getspecific(thr_key_t key);
+int thr_setspecific(thr_key_t key, void *value);
+
+#endif /* _THR_SPECIFIC_H */
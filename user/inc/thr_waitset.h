@@ -0,0 +1,45 @@
+/** @file thr_waitset.h
+ *  @brief This file declares the waitset structure, used to join whichever
+ *   thread of a set exits first, as well as functions to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _THR_WAITSET_H
+#define _THR_WAITSET_H
+
+#include <mutex_type.h>
+#include <cond_type.h>
+
+/** @brief A structure that represents a set of threads which are joined in
+ *   the order they exit in
+ */
+typedef struct thr_waitset {
+
+  /** @brief The number of threads in the set which were not joined yet
+   */
+  int nb_members;
+
+  /** @brief The first thread of the set which exited and was not joined yet
+   */
+  struct tcb *exited_head;
+
+  /** @brief The last thread of the set which exited and was not joined yet
+   */
+  struct tcb *exited_tail;
+
+  /** @brief A mutex protecting the set
+   */
+  mutex_t mp;
+
+  /** @brief A condition variable signaled once for each exiting thread
+   */
+  cond_t cv;
+
+} thr_waitset_t;
+
+int thr_waitset_init(thr_waitset_t *waitset);
+void thr_waitset_destroy(thr_waitset_t *waitset);
+int thr_waitset_add(thr_waitset_t *waitset, int tid);
+int thr_waitset_join(thr_waitset_t *waitset, int *tidp, void **statusp);
+
+#endif /* _THR_WAITSET_H */
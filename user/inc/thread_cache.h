@@ -0,0 +1,35 @@
+/** @file thread_cache.h
+ *  @brief This file declares the per-thread cache of free memory blocks used
+ *   by malloc() as well as functions to use it.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _THREAD_CACHE_H
+#define _THREAD_CACHE_H
+
+/** @brief Number of size classes cached by each thread
+ */
+#define NB_SIZE_CLASSES 6
+
+/** @brief A structure that represents a thread's cache of free blocks
+ *
+ *  For each size class, the cache holds a list of free blocks, linked through
+ *  the first word of their payload. Only the thread owning the cache touches
+ *  it, hence it does not need to be protected by a lock.
+ */
+typedef struct thread_cache {
+
+  /** @brief The lists of free blocks, one per size class
+   */
+  void *free_lists[NB_SIZE_CLASSES];
+
+  /** @brief The number of blocks in each list
+   */
+  int nb_free[NB_SIZE_CLASSES];
+
+} thread_cache_t;
+
+void thread_cache_init(thread_cache_t *cache);
+void thread_cache_flush(thread_cache_t *cache);
+
+#endif /* _THREAD_CACHE_H */
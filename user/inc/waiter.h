@@ -0,0 +1,47 @@
+/** @file waiter.h
+ *  @brief This file declares the waiter_t structure used by the blocking
+ *   synchronization primitives to keep track of descheduled threads.
+ *  @author akanjani, lramire1
+ */
+
+#ifndef _WAITER_H
+#define _WAITER_H
+
+/** @brief A structure that represents a thread blocked on a synchronization
+ *   primitive. It lives on the blocked thread's stack for as long as the
+ *   thread is waiting, so putting a thread to sleep never allocates memory.
+ */
+typedef struct waiter {
+
+  /** @brief The kernel issued tid of the blocked thread
+   */
+  int kernel_tid;
+
+  /** @brief The mutex ticket the blocked thread is waiting for
+   */
+  int ticket;
+
+  /** @brief The reject flag given to deschedule(). It is set to a non-zero
+   *   value by the thread waking up the blocked thread before it calls
+   *   make_runnable(), so a wakeup can never be lost
+   */
+  volatile int wakeup;
+
+  /** @brief The mutex a thread waiting on a condition variable has to
+   *   re-acquire once it is signaled
+   */
+  struct mutex *mutex;
+
+  /** @brief Set when cond_broadcast() moved the waiter from the condition
+   *   variable onto its mutex's list of waiters. The thread then owns the
+   *   mutex when it is woken up
+   */
+  int requeued;
+
+  /** @brief The next blocked thread in the list
+   */
+  struct waiter *next;
+
+} waiter_t;
+
+#endif /* _WAITER_H */
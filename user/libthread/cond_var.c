@@ -25,10 +25,27 @@
  */
 #define CVAR_UNINITIALIZED 0
 
-/** @brief The parameter to deschedule to put a thread from the running queu to
- *   the waiting queue of the scheduler.
+/** @brief Wakes up a thread whose waiter record was removed from the list
+ *
+ *  The waiter's flag is set before make_runnable() is called. Since the flag
+ *  is also the reject argument of the waiter's deschedule() call, a wakeup
+ *  which happens before the waiter actually descheduled itself is never lost
+ *  and we never need to retry. The caller must hold the condition variable's
+ *  spinlock, which the waiter takes once after waking up, so that our
+ *  make_runnable() call can not wake it up from a later deschedule().
+ *
+ *  @param waiter The waiter to wake up
+ *
+ *  @return void
  */
-#define DONT_RUN 0
+static void wake_waiter(waiter_t *waiter) {
+
+  // The waiter's record may disappear as soon as its flag is set
+  int tid = waiter->kernel_tid;
+  waiter->wakeup = 1;
+
+  make_runnable(tid);
+}
 
 /** @brief Initializes a condition variable
  *
@@ -51,8 +68,12 @@ int cond_init(cond_t *cv) {
   // Initialize the cvar state
   cv->init = CVAR_INITIALIZED;
 
-  // Initialize the waiting queue
-  queue_init(&cv->waiting_queue);
+  // Initialize the list of waiting threads
+  cv->head = NULL;
+  cv->tail = NULL;
+  if (spinlock_init(&cv->waiters_lock) < 0) {
+    return -1;
+  }
 
   return 0;
 }
@@ -78,7 +99,7 @@ void cond_destroy(cond_t *cv) {
   assert(cv->init == CVAR_INITIALIZED);
 
   // Illegal Operation. Destroy on a cvar for which thread(s) are waiting for
-  assert(is_queue_empty(&cv->waiting_queue) == 1);
+  assert(cv->head == NULL);
 
   // Reset the state
   cv->init = CVAR_UNINITIALIZED;
@@ -105,15 +126,43 @@ void cond_wait(cond_t *cv, mutex_t *mp) {
   // Illegal Operation. cond_wait on an uninitialized cvar
   assert(cv->init == CVAR_INITIALIZED);
 
-  // Add this thread to the waiting queue of this condition variable
-  queue_insert_node(&cv->waiting_queue, (void *)thr_get_my_kernel_id());
+  // Describe ourselves on our own stack
+  waiter_t waiter;
+  waiter.kernel_tid = thr_get_my_kernel_id();
+  waiter.wakeup = 0;
+  waiter.mutex = mp;
+  waiter.requeued = 0;
+  waiter.next = NULL;
+
+  // Add this thread at the end of the list of waiting threads
+  spinlock_lock(&cv->waiters_lock);
+  if (cv->tail == NULL) {
+    cv->head = &waiter;
+  } else {
+    cv->tail->next = &waiter;
+  }
+  cv->tail = &waiter;
+  spinlock_unlock(&cv->waiters_lock);
 
   // Release the mutex so that other threads can run now
   mutex_unlock(mp);
 
-  // Tell the scheduler to not run this thread
-  int dont_run = DONT_RUN;
-  deschedule(&dont_run);
+  // Tell the scheduler to not run this thread until we are signaled
+  while (!waiter.wakeup) {
+    deschedule((int *)&waiter.wakeup);
+  }
+
+  // Wait for the signaling thread to be done with its make_runnable() call
+  spinlock_lock(&cv->waiters_lock);
+  spinlock_unlock(&cv->waiters_lock);
+
+  if (waiter.requeued) {
+    // We were handed the mutex by mutex_unlock(). Wait for the unlocking
+    // thread to be done with its make_runnable() call too
+    spinlock_lock(&mp->waiters_lock);
+    spinlock_unlock(&mp->waiters_lock);
+    return;
+  }
 
   // Take the mutex before leaving cvar_wait
   mutex_lock(mp);
@@ -134,24 +183,29 @@ void cond_signal(cond_t *cv) {
   // Illegal operation. cond_signal on an uninitialized cvar
   assert(cv->init == CVAR_INITIALIZED);
 
-  // Pop the head element from the queue
-  void *tid = queue_delete_node(&cv->waiting_queue);
-
-  // Check that the queue was not empty
-  if (tid != NULL) {
-
-    // Start the thread which was just dequed from the waiting queue
-    while (make_runnable((int)tid) < 0) {
-      // The thread hasn't descheduled yet. Yield to it so that it can
-      // deschedule
-      yield((int)tid);
+  // Pop the head element from the list and wake it up
+  spinlock_lock(&cv->waiters_lock);
+  waiter_t *waiter = cv->head;
+  if (waiter != NULL) {
+    cv->head = waiter->next;
+    if (cv->head == NULL) {
+      cv->tail = NULL;
     }
+    wake_waiter(waiter);
   }
+  spinlock_unlock(&cv->waiters_lock);
 }
 
 /** @brief Wakes up all threads waiting on the condition variable pointed to
  *   by cv
  *
+ *  Rather than making every waiting thread runnable at once, only to have all
+ *  of them contend for the same mutex, the waiting threads are moved (in
+ *  order) onto the list of threads waiting for their mutex ("wait morphing").
+ *  They are then woken up one at a time by mutex_unlock(), each one owning
+ *  the mutex when it runs. A thread whose turn has already come is woken up
+ *  right away.
+ *
  *  @param cv A pointer to the condition variable
  *
  *  @return void
@@ -164,14 +218,21 @@ void cond_broadcast(cond_t *cv) {
   // Illegal operation. cond_broadcast on an uninitialized cvar
   assert(cv->init == CVAR_INITIALIZED);
 
-  void* tid = NULL;
-
-  // Loop through the whole waiting queue
-  while ((tid = queue_delete_node(&cv->waiting_queue)) != NULL) {
-    while (make_runnable((int)tid) < 0) {
-      // The thread hasn't descheduled yet. Yield to it so that it can
-      // deschedule
-      yield((int)(tid));
+  // Hand every thread in the list over to its mutex
+  spinlock_lock(&cv->waiters_lock);
+  waiter_t *waiter = cv->head;
+  cv->head = NULL;
+  cv->tail = NULL;
+
+  while (waiter != NULL) {
+    // The waiter's next field is reused by the mutex's list
+    waiter_t *next = waiter->next;
+    waiter->requeued = 1;
+    if (mutex_requeue_waiter(waiter->mutex, waiter) == 1) {
+      // The mutex is available for this thread already
+      wake_waiter(waiter);
     }
+    waiter = next;
   }
+  spinlock_unlock(&cv->waiters_lock);
 }
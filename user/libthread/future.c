@@ -0,0 +1,308 @@
+/** @file future.c
+ *
+ *  @brief This file contains the definitions for the future functions
+ *
+ *  A future holds a value which is handed over only once, either by a thread
+ *  calling future_fulfill() or by a task pool worker running the function
+ *  given to future_spawn(). Like thr_join() for a thread's exit status, any
+ *  thread can then wait for the value. Unlike thr_join(), a future is not
+ *  tied to a thread: it can also be polled, and continuations can be chained
+ *  on it so that dependent computations start as soon as it is fulfilled,
+ *  without a thread blocking for each pending value.
+ *
+ *  Waiting threads deschedule themselves on the future's list of waiters,
+ *  which the fulfilling thread empties. A worker of the pool fulfilling the
+ *  future runs other tasks of the pool instead of blocking.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <future.h>
+#include <syscall.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <thr_internals.h>
+
+/** @brief State of a future which was not fulfilled yet
+ */
+#define FUTURE_PENDING 0
+
+/** @brief State of a future which was fulfilled
+ */
+#define FUTURE_FULFILLED 1
+
+/** @brief Initializes a future
+ *
+ *  @param future The future to initialize
+ *
+ *  @return 0 on success, a negative number on error
+ */
+int future_init(future_t *future) {
+
+  // Check validity of arguments
+  if (future == NULL) {
+    return -1;
+  }
+
+  future->state = FUTURE_PENDING;
+  future->value = NULL;
+  future->waiters = NULL;
+  future->continuations = NULL;
+  future->pool = NULL;
+  future->func = NULL;
+  future->arg = NULL;
+
+  return spinlock_init(&future->lock);
+}
+
+/** @brief Destroys a future
+ *
+ *  It is illegal to destroy a future that threads are waiting on, that has
+ *  continuations left to call, or that a pool task will fulfill.
+ *
+ *  @param future The future to destroy
+ *
+ *  @return void
+ */
+void future_destroy(future_t *future) {
+
+  // Invalid parameter
+  assert(future);
+
+  // Wait for a thread fulfilling the future to be done with it
+  spinlock_lock(&future->lock);
+
+  // Illegal operation. Destroying a future which is still in use
+  assert(future->waiters == NULL && future->continuations == NULL);
+  assert(future->state == FUTURE_FULFILLED || future->pool == NULL);
+
+  spinlock_unlock(&future->lock);
+}
+
+/** @brief Fulfills a future, waking up the threads waiting on it and calling
+ *   its continuations
+ *
+ *  The continuations are called by the calling thread, in the order they
+ *  were registered in.
+ *
+ *  @param future The future
+ *  @param value  The value of the future
+ *
+ *  @return 0 on success, a negative number if the future was already
+ *   fulfilled
+ */
+int future_fulfill(future_t *future, void *value) {
+
+  // Invalid parameter
+  assert(future);
+
+  spinlock_lock(&future->lock);
+
+  if (future->state == FUTURE_FULFILLED) {
+    spinlock_unlock(&future->lock);
+    return -1;
+  }
+
+  future->value = value;
+  future->state = FUTURE_FULFILLED;
+
+  // Wake up every waiting thread. Each of them takes the spinlock once after
+  // waking up, so that our make_runnable() call can not wake it up later
+  while (future->waiters != NULL) {
+    waiter_t *waiter = future->waiters;
+    future->waiters = waiter->next;
+
+    // The waiter's record may disappear as soon as its flag is set
+    int tid = waiter->kernel_tid;
+    waiter->wakeup = 1;
+    make_runnable(tid);
+  }
+
+  // Take the continuations, in the order they were registered in
+  future_continuation_t *continuations = NULL;
+  while (future->continuations != NULL) {
+    future_continuation_t *continuation = future->continuations;
+    future->continuations = continuation->next;
+    continuation->next = continuations;
+    continuations = continuation;
+  }
+
+  spinlock_unlock(&future->lock);
+
+  // The future may be destroyed by now, only use the continuations' records
+  while (continuations != NULL) {
+    future_continuation_t *continuation = continuations;
+    continuations = continuation->next;
+    continuation->func(value, continuation->arg);
+  }
+
+  return 0;
+}
+
+/** @brief The function run by the pool task of a future given to
+ *   future_spawn()
+ *
+ *  @param arg The future
+ *
+ *  @return NULL
+ */
+static void *run_future(void *arg) {
+
+  future_t *future = arg;
+  future_fulfill(future, future->func(future->arg));
+
+  return NULL;
+}
+
+/** @brief Has a task pool fulfill a future with the return value of a
+ *   function
+ *
+ *  The function is run as a pool task (see task_pool_spawn()), which does not
+ *  need to be waited on.
+ *
+ *  @param pool   The pool
+ *  @param future The future, which must be initialized and pending
+ *  @param func   The function
+ *  @param arg    The argument given to the function
+ *
+ *  @return void
+ */
+void future_spawn(task_pool_t *pool, future_t *future,
+                  void *(*func)(void *), void *arg) {
+
+  // Invalid parameter
+  assert(pool && future && func);
+
+  // Illegal operation. The future already has a producer
+  assert(future->state == FUTURE_PENDING && future->pool == NULL);
+
+  future->pool = pool;
+  future->func = func;
+  future->arg = arg;
+
+  task_pool_spawn_detached(pool, &future->task, run_future, future);
+}
+
+/** @brief Waits for a future to be fulfilled
+ *
+ *  If the future was given to future_spawn() and the calling thread is one of
+ *  the pool's workers, it runs other tasks of the pool while it waits.
+ *  Otherwise, it deschedules itself until the future is fulfilled.
+ *
+ *  @param future The future
+ *  @param valuep If not NULL, the value of the future is stored there
+ *
+ *  @return 0
+ */
+int future_wait(future_t *future, void **valuep) {
+
+  // Invalid parameter
+  assert(future);
+
+  task_pool_t *pool = future->pool;
+
+  if (future->state == FUTURE_PENDING && pool != NULL &&
+      task_pool_my_worker(pool) != NULL) {
+    // Help the other workers until the future is fulfilled
+    while (future->state == FUTURE_PENDING) {
+      if (task_pool_run_one(pool) < 0) {
+        yield(-1);
+      }
+    }
+  }
+
+  if (future->state == FUTURE_PENDING) {
+
+    // Describe ourselves on our own stack
+    waiter_t waiter;
+    waiter.kernel_tid = thr_get_my_kernel_id();
+    waiter.wakeup = 0;
+
+    spinlock_lock(&future->lock);
+
+    if (future->state == FUTURE_PENDING) {
+      waiter.next = future->waiters;
+      future->waiters = &waiter;
+      spinlock_unlock(&future->lock);
+
+      // Tell the scheduler to not run this thread until we are woken up
+      while (!waiter.wakeup) {
+        deschedule((int *)&waiter.wakeup);
+      }
+
+      // Wait for the fulfilling thread to be done with its make_runnable()
+      spinlock_lock(&future->lock);
+    }
+
+    spinlock_unlock(&future->lock);
+  }
+
+  if (valuep != NULL) {
+    *valuep = future->value;
+  }
+
+  return 0;
+}
+
+/** @brief Checks whether a future was fulfilled, without waiting
+ *
+ *  @param future The future
+ *  @param valuep If not NULL and the future was fulfilled, the value of the
+ *   future is stored there
+ *
+ *  @return 0 if the future was fulfilled, a negative number otherwise
+ */
+int future_poll(future_t *future, void **valuep) {
+
+  // Invalid parameter
+  assert(future);
+
+  if (future->state == FUTURE_PENDING) {
+    return -1;
+  }
+
+  if (valuep != NULL) {
+    *valuep = future->value;
+  }
+
+  return 0;
+}
+
+/** @brief Registers a function to call with the value of a future once it is
+ *   fulfilled
+ *
+ *  The function is called by the thread fulfilling the future, or right away
+ *  by the calling thread if the future was already fulfilled. It may for
+ *  example fulfill another future, or spawn a pool task depending on the
+ *  value.
+ *
+ *  @param future       The future
+ *  @param continuation The continuation's record, which must stay valid
+ *   until the function is called
+ *  @param func         The function, called with the future's value and arg
+ *  @param arg          The second argument given to the function
+ *
+ *  @return void
+ */
+void future_then(future_t *future, future_continuation_t *continuation,
+                 void (*func)(void *value, void *arg), void *arg) {
+
+  // Invalid parameter
+  assert(future && continuation && func);
+
+  continuation->func = func;
+  continuation->arg = arg;
+
+  spinlock_lock(&future->lock);
+
+  if (future->state == FUTURE_PENDING) {
+    continuation->next = future->continuations;
+    future->continuations = continuation;
+    spinlock_unlock(&future->lock);
+    return;
+  }
+
+  spinlock_unlock(&future->lock);
+
+  func(future->value, arg);
+}
@@ -0,0 +1,89 @@
+/** @file generic_node.c
+ *
+ *  @brief This file contains the definitions for the functions allocating
+ *   the nodes of the generic queues and linked lists
+ *
+ *  Nodes come from a slab cache shared by every queue and linked list, which
+ *  is initialized the first time a node is allocated.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <generic_node.h>
+#include <slab.h>
+#include <atomic_ops.h>
+#include <syscall.h>
+#include <stdlib.h>
+
+/** @brief A macro for 0 being treated as FALSE
+ */
+#define FALSE 0
+
+/** @brief A macro for 1 being treated as TRUE
+ */
+#define TRUE 1
+
+/** @brief The cache the nodes are allocated from
+ */
+static slab_cache_t node_cache;
+
+/** @brief Set by the thread initializing the node cache
+ */
+static int initializing = FALSE;
+
+/** @brief Set once the node cache can be used
+ */
+static volatile int initialized = FALSE;
+
+/** @brief Initialize the node cache the first time a node is allocated
+ *
+ *  @return void
+ */
+static void init_node_cache(void) {
+
+  if (initialized == TRUE) {
+    return;
+  }
+
+  if (atomic_exchange(&initializing, TRUE) == FALSE) {
+    // We are the first one here, initialize the cache
+    slab_cache_init(&node_cache, sizeof(generic_node_t));
+    initialized = TRUE;
+  } else {
+    // Wait for the thread initializing the cache
+    while (initialized == FALSE) {
+      yield(-1);
+    }
+  }
+}
+
+/** @brief Allocate a node
+ *
+ *  @param value The value to be stored in the node
+ *
+ *  @return The new node, NULL if there is not enough memory
+ */
+generic_node_t *generic_node_alloc(void *value) {
+
+  init_node_cache();
+
+  generic_node_t *node = slab_alloc(&node_cache);
+  if (node == NULL) {
+    return NULL;
+  }
+
+  node->value = value;
+  node->next = NULL;
+
+  return node;
+}
+
+/** @brief Free a node allocated by generic_node_alloc()
+ *
+ *  @param node The node
+ *
+ *  @return void
+ */
+void generic_node_free(generic_node_t *node) {
+  slab_free(&node_cache, node);
+}
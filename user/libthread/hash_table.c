@@ -7,52 +7,249 @@
  */
 
 #include <hash_table.h>
-#include <linked_list.h>
 #include <stdlib.h>
 #include <mutex.h>
 
+/** @brief Minimum number of slots in a hash table
+ */
+#define HASH_TABLE_MIN_CAPACITY 8
+
+/** @brief Number of slots of the old table moved to the current table by
+ *   each operation while rehashing
+ */
+#define HASH_TABLE_REHASH_STEP 4
+
+/** @brief Maximum number of slots in a hash table
+ */
+#define HASH_TABLE_MAX_CAPACITY (1U << 28)
+
+/** @brief Hash a key
+ *
+ *  @param key      The key
+ *  @param capacity The number of slots in the table (a power of two)
+ *
+ *  @return The key's ideal slot in the table
+ */
+static unsigned int hash_key(unsigned int key, unsigned int capacity) {
+
+  // Mix the bits of the key so that sequential keys spread over the table
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+
+  return key & (capacity - 1);
+}
+
+/** @brief Find the slot holding a key in a table
+ *
+ *  @param entries  The table
+ *  @param capacity The number of slots in the table
+ *  @param key      The key
+ *
+ *  @return The index of the slot holding the key, -1 if it is not there
+ */
+static int find_slot(hash_table_entry_t *entries, unsigned int capacity,
+                     unsigned int key) {
+
+  unsigned int i = hash_key(key, capacity);
+
+  // Probe until we reach an empty slot
+  while (entries[i].value != NULL) {
+    if (entries[i].key == key) {
+      return i;
+    }
+    i = (i + 1) & (capacity - 1);
+  }
+
+  return -1;
+}
+
+/** @brief Insert an element in a table
+ *
+ *  The table must have at least one empty slot and must not contain the key.
+ *
+ *  @param entries  The table
+ *  @param capacity The number of slots in the table
+ *  @param key      The element's key
+ *  @param value    The element
+ *
+ *  @return void
+ */
+static void insert_entry(hash_table_entry_t *entries, unsigned int capacity,
+                         unsigned int key, void *value) {
+
+  unsigned int i = hash_key(key, capacity);
+
+  // Find the first empty slot after the key's ideal slot
+  while (entries[i].value != NULL) {
+    i = (i + 1) & (capacity - 1);
+  }
+
+  entries[i].key = key;
+  entries[i].value = value;
+}
+
+/** @brief Empty a slot of a table
+ *
+ *  The elements following the slot in its cluster are shifted backwards when
+ *  possible, so that every element can still be reached from its ideal slot
+ *  without leaving a tombstone behind.
+ *
+ *  @param entries  The table
+ *  @param capacity The number of slots in the table
+ *  @param i        The index of the slot to empty
+ *
+ *  @return void
+ */
+static void delete_slot(hash_table_entry_t *entries, unsigned int capacity,
+                        unsigned int i) {
+
+  unsigned int mask = capacity - 1;
+  unsigned int j = (i + 1) & mask;
+
+  while (entries[j].value != NULL) {
+    unsigned int ideal = hash_key(entries[j].key, capacity);
+
+    // The element at j can move to i if i lies between its ideal slot and j
+    if (((j - ideal) & mask) >= ((j - i) & mask)) {
+      entries[i] = entries[j];
+      i = j;
+    }
+    j = (j + 1) & mask;
+  }
+
+  entries[i].value = NULL;
+}
+
+/** @brief Move a few elements of the old table to the current one
+ *
+ *  The caller must hold the hash table's mutex.
+ *
+ *  @param hash_table The hash table
+ *  @param nb_slots   The maximum number of old slots to look at
+ *
+ *  @return void
+ */
+static void rehash_step(generic_hash_table_t *hash_table,
+                        unsigned int nb_slots) {
+
+  if (hash_table->old_entries == NULL) {
+    // No rehashing in progress
+    return;
+  }
+
+  while (nb_slots > 0 && hash_table->old_nb_elements > 0) {
+    hash_table_entry_t *entry =
+      &hash_table->old_entries[hash_table->rehash_index];
+
+    if (entry->value == NULL) {
+      // Every slot before this one is empty, go to the next one
+      ++hash_table->rehash_index;
+      --nb_slots;
+      continue;
+    }
+
+    // Move the element. Another element of the cluster may be shifted in
+    // this slot, in which case we look at the slot again
+    insert_entry(hash_table->entries, hash_table->capacity, entry->key,
+                 entry->value);
+    ++hash_table->nb_elements;
+    delete_slot(hash_table->old_entries, hash_table->old_capacity,
+                hash_table->rehash_index);
+    --hash_table->old_nb_elements;
+    --nb_slots;
+  }
+
+  if (hash_table->old_nb_elements == 0) {
+    // Rehashing is done
+    free(hash_table->old_entries);
+    hash_table->old_entries = NULL;
+    hash_table->old_capacity = 0;
+  }
+}
+
+/** @brief Start growing the hash table
+ *
+ *  A table twice as large as the current one is allocated and becomes the
+ *  current table. The elements of the previous table will be moved to it by
+ *  subsequent operations. The caller must hold the hash table's mutex.
+ *
+ *  @param hash_table The hash table
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+static int grow(generic_hash_table_t *hash_table) {
+
+  // Finish any rehashing still in progress first
+  while (hash_table->old_entries != NULL) {
+    rehash_step(hash_table, HASH_TABLE_REHASH_STEP);
+  }
+
+  if (hash_table->capacity >= HASH_TABLE_MAX_CAPACITY) {
+    return -1;
+  }
+
+  hash_table_entry_t *entries = calloc(2 * hash_table->capacity,
+                                       sizeof(hash_table_entry_t));
+  if (entries == NULL) {
+    return -1;
+  }
+
+  hash_table->old_entries = hash_table->entries;
+  hash_table->old_capacity = hash_table->capacity;
+  hash_table->old_nb_elements = hash_table->nb_elements;
+  hash_table->rehash_index = 0;
+
+  hash_table->entries = entries;
+  hash_table->capacity *= 2;
+  hash_table->nb_elements = 0;
+
+  return 0;
+}
+
 /** @brief Initialize the hash table
  *
  *  The function must be called once before any other function in this file,
  *  otherwise the hash table's behavior is undefined.
  *
  *  @param hash_table     The hash table to initialize
- *  @param nb_buckets     The number of buckets in the hash table
- *  @param find           Function to find a particular element in the list
- *  @param hash_function  A hashing function
+ *  @param capacity       The initial number of slots in the hash table (it is
+ *                        rounded up to a power of two), at most
+ *                        HASH_TABLE_MAX_CAPACITY
  *
  *  @return 0 on success, a negative error code on failure
  */
-int hash_table_init(generic_hash_table_t *hash_table, unsigned int nb_buckets,
-                    int (*find)(void *, void *),
-                    unsigned int (*hash_function)(void *, unsigned int)) {
+int hash_table_init(generic_hash_table_t *hash_table, unsigned int capacity) {
 
   // Check validity of arguments
-  if (hash_table == NULL || nb_buckets <= 0 || find == NULL || 
-      hash_function == NULL) {
+  if (hash_table == NULL || capacity > HASH_TABLE_MAX_CAPACITY) {
     return -1;
   }
 
-  hash_table->nb_buckets = nb_buckets;
-  hash_table->hash_function = hash_function;
+  // Round the capacity up to a power of two
+  unsigned int size = HASH_TABLE_MIN_CAPACITY;
+  while (size < capacity) {
+    size *= 2;
+  }
 
-  // Allocate the buckets
-  hash_table->buckets =
-      calloc(hash_table->nb_buckets, sizeof(generic_linked_list_t));
-  if (hash_table->buckets == NULL) {
+  // Allocate the slots
+  hash_table->entries = calloc(size, sizeof(hash_table_entry_t));
+  if (hash_table->entries == NULL) {
     return -1;
   }
 
-  // Initialize the hash table
-  int i;
-  for (i = 0; i < hash_table->nb_buckets; ++i) {
-
-    // Initialize each list
-    if (linked_list_init(&hash_table->buckets[i], find) < 0) {
-      free(hash_table->buckets);
-      return -1;
-    }
+  hash_table->capacity = size;
+  hash_table->nb_elements = 0;
+  hash_table->old_entries = NULL;
+  hash_table->old_capacity = 0;
+  hash_table->old_nb_elements = 0;
+  hash_table->rehash_index = 0;
 
+  if (mutex_init(&hash_table->mp) < 0) {
+    free(hash_table->entries);
+    return -1;
   }
 
   return 0;
@@ -61,74 +258,148 @@ int hash_table_init(generic_hash_table_t *hash_table, unsigned int nb_buckets,
 /** @brief Add an element to the hash table
  *
  *  @param hash_table The hash table
+ *  @param key        The element's key
  *  @param elem       The element to add
  *
- *  @return 0 on success, a negative error code on failure
+ *  @return 0 on success, a negative error code on failure (in particular if
+ *   the key is already in the hash table)
  */
-int hash_table_add_element(generic_hash_table_t *hash_table, void *elem) {
+int hash_table_add_element(generic_hash_table_t *hash_table, unsigned int key,
+                           void *elem) {
 
   // Check validity of arguments
-  if (hash_table == NULL || hash_table->hash_function == NULL || elem == NULL) {
+  if (hash_table == NULL || elem == NULL) {
     return -1;
   }
 
-  // Compute in which bucket the element will go
-  unsigned int bucket = hash_table->hash_function(elem, hash_table->nb_buckets);
-  if (bucket < 0 || bucket >= hash_table->nb_buckets) {
+  mutex_lock(&hash_table->mp);
+
+  rehash_step(hash_table, HASH_TABLE_REHASH_STEP);
+
+  // Keys are unique
+  if (find_slot(hash_table->entries, hash_table->capacity, key) >= 0 ||
+      (hash_table->old_entries != NULL &&
+       find_slot(hash_table->old_entries, hash_table->old_capacity,
+                 key) >= 0)) {
+    mutex_unlock(&hash_table->mp);
     return -1;
   }
 
-  // Add the element to the appropriate linked list
-  if (linked_list_insert_node(&hash_table->buckets[bucket], elem) < 0) {
+  // Keep the load factor under 3/4
+  unsigned int total = hash_table->nb_elements + hash_table->old_nb_elements;
+  if (4 * (total + 1) > 3 * hash_table->capacity &&
+      grow(hash_table) < 0 &&
+      hash_table->nb_elements + 1 >= hash_table->capacity) {
+    // We could not grow and the table is full
+    mutex_unlock(&hash_table->mp);
     return -1;
   }
 
+  insert_entry(hash_table->entries, hash_table->capacity, key, elem);
+  ++hash_table->nb_elements;
+
+  mutex_unlock(&hash_table->mp);
+
   return 0;
 }
 
 /** @brief Remove an element in the hash table
  *
  *  @param hash_table   A hash table
- *  @param elem        The element to remove
+ *  @param key          The key of the element to remove
  *
  *  @return The deleted element's value if it was found in the list.
  *  NULL otherwise
  */
-void *hash_table_remove_element(generic_hash_table_t *hash_table, void *elem) {
+void *hash_table_remove_element(generic_hash_table_t *hash_table,
+                                unsigned int key) {
 
   // Check validity of arguments
-  if (hash_table == NULL || hash_table->hash_function == NULL || elem == NULL) {
+  if (hash_table == NULL) {
     return NULL;
   }
 
-  // Compute in which bucket the element could be
-  unsigned int bucket = hash_table->hash_function(elem, hash_table->nb_buckets);
-  if (bucket < 0 || bucket >= hash_table->nb_buckets) {
-    return NULL;
+  mutex_lock(&hash_table->mp);
+
+  rehash_step(hash_table, HASH_TABLE_REHASH_STEP);
+
+  void *ret = NULL;
+
+  // Look in the current table first, then in the old one
+  int i = find_slot(hash_table->entries, hash_table->capacity, key);
+  if (i >= 0) {
+    ret = hash_table->entries[i].value;
+    delete_slot(hash_table->entries, hash_table->capacity, i);
+    --hash_table->nb_elements;
+  } else if (hash_table->old_entries != NULL &&
+             (i = find_slot(hash_table->old_entries, hash_table->old_capacity,
+                            key)) >= 0) {
+    ret = hash_table->old_entries[i].value;
+    delete_slot(hash_table->old_entries, hash_table->old_capacity, i);
+    --hash_table->old_nb_elements;
+    rehash_step(hash_table, 0);
   }
 
-  return linked_list_delete_node(&hash_table->buckets[bucket], elem);
+  mutex_unlock(&hash_table->mp);
+
+  return ret;
 }
 
 /** @brief Get an element in the hash table
  *
  *  @param hash_table   A hash_table
- *  @param elem         The element to ger
+ *  @param key          The key of the element to get
  *
  *  @return The element if it was found in the hash table. NULL otherwise.
  */
-void *hash_table_get_element(generic_hash_table_t *hash_table, void *elem) {
+void *hash_table_get_element(generic_hash_table_t *hash_table,
+                             unsigned int key) {
 
   // Check validity of arguments
-  if (hash_table == NULL || hash_table->hash_function == NULL || elem == NULL) {
+  if (hash_table == NULL) {
     return NULL;
   }
 
-  // Compute in which bucket the element could be
-  unsigned int bucket = hash_table->hash_function(elem, hash_table->nb_buckets);
-  if (bucket < 0 || bucket >= hash_table->nb_buckets) {
-    return NULL;
+  mutex_lock(&hash_table->mp);
+
+  rehash_step(hash_table, HASH_TABLE_REHASH_STEP);
+
+  void *ret = NULL;
+
+  // Look in the current table first, then in the old one
+  int i = find_slot(hash_table->entries, hash_table->capacity, key);
+  if (i >= 0) {
+    ret = hash_table->entries[i].value;
+  } else if (hash_table->old_entries != NULL &&
+             (i = find_slot(hash_table->old_entries, hash_table->old_capacity,
+                            key)) >= 0) {
+    ret = hash_table->old_entries[i].value;
+  }
+
+  mutex_unlock(&hash_table->mp);
+
+  return ret;
+}
+
+/** @brief Destroy the hash table
+ *
+ *  The elements still in the hash table are not freed.
+ *
+ *  @param hash_table   A hash_table
+ *
+ *  @return void
+ */
+void hash_table_destroy(generic_hash_table_t *hash_table) {
+
+  // Check validity of arguments
+  if (hash_table == NULL) {
+    return;
   }
 
-  return linked_list_get_node(&hash_table->buckets[bucket], elem);
+  mutex_destroy(&hash_table->mp);
+
+  free(hash_table->entries);
+  hash_table->entries = NULL;
+  free(hash_table->old_entries);
+  hash_table->old_entries = NULL;
 }
@@ -56,12 +56,10 @@ int linked_list_insert_node(generic_linked_list_t *list, void *value) {
   }
 
   // Allocate a new node
-  generic_node_t *new_node = malloc(sizeof(generic_node_t));
+  generic_node_t *new_node = generic_node_alloc(value);
   if (new_node == NULL) {
     return -1;
   }
-  new_node->value = value;
-  new_node->next = NULL;
 
   mutex_lock(&list->mp);
 
@@ -124,7 +122,7 @@ void *linked_list_delete_node(generic_linked_list_t *list, void *value) {
         prev->next = node->next;
       }
       void *ret = node->value;
-      free(node);
+      generic_node_free(node);
 
       mutex_unlock(&list->mp);
       return ret;
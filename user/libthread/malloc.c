@@ -1,13 +1,22 @@
 /** @file malloc.c
  *  @brief This file contains the definitions for thread safe malloc functions
+ *
+ *  Small blocks are served from a per-thread cache of free blocks, stored in
+ *  the thread's TCB, so that the common allocation never takes the global
+ *  mutex. The cache is refilled from (and flushed to) the shared heap in
+ *  batches. Every block starts with a small header recording its size class.
+ *
  *  @author akanjani, lramire1
  */
 
 #include <stdlib.h>
 #include <types.h>
 #include <stddef.h>
+#include <string.h>
 #include <mutex.h>
 #include <atomic_ops.h>
+#include <thread_cache.h>
+#include <thr_internals.h>
 
 /** @brief A macro for 0 being treated as FALSE
  */
@@ -17,6 +26,37 @@
  */
 #define TRUE 1
 
+/** @brief Size class of blocks which are too large to be cached
+ */
+#define LARGE_BLOCK -1
+
+/** @brief Payload size of the smallest size class
+ */
+#define MIN_CLASS_SIZE 16
+
+/** @brief Number of blocks taken from the heap when a cache list is empty
+ */
+#define CACHE_REFILL_BATCH 8
+
+/** @brief Maximum number of blocks in a cache list. When it is exceeded, half
+ *   of the list is given back to the heap
+ */
+#define CACHE_MAX_BLOCKS 32
+
+/** @brief Header placed before every block returned by malloc()
+ */
+typedef struct block_header {
+
+  /** @brief Size class of the block, or LARGE_BLOCK
+   */
+  int size_class;
+
+  /** @brief Payload size of the block
+   */
+  size_t size;
+
+} block_header_t;
+
 /** @brief State of the mutex
  */
 static int initialized = FALSE;
@@ -25,6 +65,176 @@ static int initialized = FALSE;
  */
 static mutex_t alloc_mutex;
 
+/** @brief Initialize the global mutex the first time the library is used
+ *
+ *  @return void
+ */
+static void init_alloc_mutex(void) {
+
+  if (initialized == FALSE && atomic_exchange(&initialized, TRUE) == FALSE) {
+    // The mutex has not been initialized yet. Initialize it
+    mutex_init(&alloc_mutex);
+  }
+}
+
+/** @brief Get the size class for a payload size
+ *
+ *  @param size The payload size
+ *
+ *  @return The size class, or LARGE_BLOCK if the size is too large
+ */
+static int size_to_class(size_t size) {
+
+  int size_class = 0;
+  size_t class_size = MIN_CLASS_SIZE;
+
+  while (class_size < size) {
+    if (++size_class == NB_SIZE_CLASSES) {
+      return LARGE_BLOCK;
+    }
+    class_size *= 2;
+  }
+
+  return size_class;
+}
+
+/** @brief Get the payload size of a size class
+ *
+ *  @param size_class The size class
+ *
+ *  @return The payload size
+ */
+static size_t class_to_size(int size_class) {
+  return MIN_CLASS_SIZE << size_class;
+}
+
+/** @brief Get the cache of the calling thread
+ *
+ *  @return The calling thread's cache, NULL if thr_init() was not called yet
+ */
+static thread_cache_t *get_cache(void) {
+
+  tcb_t *tcb = get_tcb();
+
+  if (tcb == NULL) {
+    return NULL;
+  }
+
+  return &tcb->cache;
+}
+
+/** @brief Allocate a block from the shared heap
+ *
+ *  @param size_class The block's size class
+ *  @param size       The block's payload size
+ *
+ *  @return The block's header, NULL if there is not enough memory
+ */
+static block_header_t *heap_alloc(int size_class, size_t size) {
+
+  mutex_lock(&alloc_mutex);
+  block_header_t *header = _malloc(sizeof(block_header_t) + size);
+  mutex_unlock(&alloc_mutex);
+
+  if (header != NULL) {
+    header->size_class = size_class;
+    header->size = size;
+  }
+
+  return header;
+}
+
+/** @brief Take up to CACHE_REFILL_BATCH blocks from the heap into a cache
+ *   list, holding the global mutex only once
+ *
+ *  @param cache      The cache
+ *  @param size_class The size class of the list to refill
+ *
+ *  @return void
+ */
+static void refill(thread_cache_t *cache, int size_class) {
+
+  size_t size = class_to_size(size_class);
+
+  mutex_lock(&alloc_mutex);
+
+  int i;
+  for (i = 0; i < CACHE_REFILL_BATCH; ++i) {
+    block_header_t *header = _malloc(sizeof(block_header_t) + size);
+    if (header == NULL) {
+      break;
+    }
+    header->size_class = size_class;
+    header->size = size;
+
+    // Link the block in the list through its payload
+    void **payload = (void **)(header + 1);
+    *payload = cache->free_lists[size_class];
+    cache->free_lists[size_class] = payload;
+    ++cache->nb_free[size_class];
+  }
+
+  mutex_unlock(&alloc_mutex);
+}
+
+/** @brief Give blocks from a cache list back to the heap, holding the global
+ *   mutex only once
+ *
+ *  @param cache      The cache
+ *  @param size_class The size class of the list to flush
+ *  @param nb_keep    The number of blocks to keep in the list
+ *
+ *  @return void
+ */
+static void flush(thread_cache_t *cache, int size_class, int nb_keep) {
+
+  mutex_lock(&alloc_mutex);
+
+  while (cache->nb_free[size_class] > nb_keep) {
+    void **payload = cache->free_lists[size_class];
+    cache->free_lists[size_class] = *payload;
+    --cache->nb_free[size_class];
+    _free((block_header_t *)payload - 1);
+  }
+
+  mutex_unlock(&alloc_mutex);
+}
+
+/** @brief Initialize a thread's cache
+ *
+ *  @param cache The cache
+ *
+ *  @return void
+ */
+void thread_cache_init(thread_cache_t *cache) {
+
+  int i;
+  for (i = 0; i < NB_SIZE_CLASSES; ++i) {
+    cache->free_lists[i] = NULL;
+    cache->nb_free[i] = 0;
+  }
+}
+
+/** @brief Give every block of a thread's cache back to the heap
+ *
+ *  This must be called by a thread before it exits.
+ *
+ *  @param cache The cache
+ *
+ *  @return void
+ */
+void thread_cache_flush(thread_cache_t *cache) {
+
+  init_alloc_mutex();
+
+  int i;
+  for (i = 0; i < NB_SIZE_CLASSES; ++i) {
+    if (cache->nb_free[i] > 0) {
+      flush(cache, i, 0);
+    }
+  }
+}
+
 /** @brief A thread-safe malloc
  *
  *  @param __size The size to be dynamically allocated
@@ -34,17 +244,33 @@ static mutex_t alloc_mutex;
  */
 void *malloc(size_t __size) {
 
-  if (initialized == FALSE && atomic_exchange(&initialized, TRUE) == FALSE) {
-    // The mutex has not been initialized yet. Initialize it
-    mutex_init(&alloc_mutex);
+  init_alloc_mutex();
+
+  int size_class = size_to_class(__size);
+  thread_cache_t *cache = get_cache();
+
+  if (size_class == LARGE_BLOCK || cache == NULL) {
+    // Make the malloc call guarded by the mutex
+    size_t size = (size_class == LARGE_BLOCK) ? __size :
+                  class_to_size(size_class);
+    block_header_t *header = heap_alloc(size_class, size);
+    return (header == NULL) ? NULL : header + 1;
   }
 
-  // Make the malloc call guarded by the mutex
-  mutex_lock(&alloc_mutex);
-  void* ptr = _malloc(__size);
-  mutex_unlock(&alloc_mutex);
+  if (cache->free_lists[size_class] == NULL) {
+    // Our cache is empty for this size, get a few blocks from the heap
+    refill(cache, size_class);
+    if (cache->free_lists[size_class] == NULL) {
+      return NULL;
+    }
+  }
 
-  return ptr;
+  // Take the first block of the list
+  void **payload = cache->free_lists[size_class];
+  cache->free_lists[size_class] = *payload;
+  --cache->nb_free[size_class];
+
+  return payload;
 }
 
 /** @brief A thread-safe calloc
@@ -57,22 +283,24 @@ void *malloc(size_t __size) {
  */
 void *calloc(size_t __nelt, size_t __eltsize) {
 
-  if (initialized == FALSE && atomic_exchange(&initialized, TRUE) == FALSE) {
-    // The mutex has not been initialized yet. Initialize it
-    mutex_init(&alloc_mutex);
+  size_t size = __nelt * __eltsize;
+
+  if (__eltsize != 0 && size / __eltsize != __nelt) {
+    // Overflow
+    return NULL;
   }
 
-  // Make the calloc call guarded by the mutex
-  mutex_lock(&alloc_mutex);
-  void* ptr = _calloc(__nelt, __eltsize);
-  mutex_unlock(&alloc_mutex);
+  void* ptr = malloc(size);
+  if (ptr != NULL) {
+    memset(ptr, 0, size);
+  }
 
   return ptr;
 }
 
 /** @brief A thread-safe realloc
  *
- *  @param __buf Pointer to a memory block previously allocated with 
+ *  @param __buf Pointer to a memory block previously allocated with
  *               malloc, calloc or realloc.
  *  @param __new_size New size for the memory block, in bytes.
  *
@@ -81,35 +309,86 @@ void *calloc(size_t __nelt, size_t __eltsize) {
  */
 void *realloc(void *__buf, size_t __new_size) {
 
-  if (initialized == FALSE && atomic_exchange(&initialized, TRUE) == FALSE) {
-    // The mutex has not been initialized yet. Initialize it
-    mutex_init(&alloc_mutex);
+  if (__buf == NULL) {
+    return malloc(__new_size);
   }
 
-  // Make the realloc call guarded by the mutex
-  mutex_lock(&alloc_mutex);
-  void* ptr = _realloc(__buf, __new_size);
-  mutex_unlock(&alloc_mutex);
+  if (__new_size == 0) {
+    free(__buf);
+    return NULL;
+  }
+
+  init_alloc_mutex();
+
+  block_header_t *header = (block_header_t *)__buf - 1;
+
+  if (__new_size <= header->size &&
+      (header->size_class != LARGE_BLOCK ||
+       size_to_class(__new_size) == LARGE_BLOCK)) {
+    // The block is already large enough
+    return __buf;
+  }
+
+  if (header->size_class == LARGE_BLOCK &&
+      size_to_class(__new_size) == LARGE_BLOCK) {
+    // Make the realloc call guarded by the mutex
+    mutex_lock(&alloc_mutex);
+    block_header_t *new_header = _realloc(header, sizeof(block_header_t) +
+                                          __new_size);
+    mutex_unlock(&alloc_mutex);
+
+    if (new_header == NULL) {
+      return NULL;
+    }
+    new_header->size = __new_size;
+    return new_header + 1;
+  }
+
+  // Move the data to a block of the appropriate size
+  void *ptr = malloc(__new_size);
+  if (ptr == NULL) {
+    return NULL;
+  }
+  memcpy(ptr, __buf, (header->size < __new_size) ? header->size : __new_size);
+  free(__buf);
 
   return ptr;
 }
 
 /** @brief A thread-safe free
  *
- *  @param __buf Pointer to a memory block previously allocated with 
+ *  @param __buf Pointer to a memory block previously allocated with
  *               malloc, calloc or realloc.
  *
  *  @return void
  */
 void free(void *__buf) {
 
-  if (initialized == FALSE && atomic_exchange(&initialized, TRUE) == FALSE) {
-    // The mutex has not been initialized yet. Initialize it
-    mutex_init(&alloc_mutex);
+  if (__buf == NULL) {
+    return;
   }
 
-  // Make the free call guarded by the mutex
-  mutex_lock(&alloc_mutex);
-  _free(__buf);
-  mutex_unlock(&alloc_mutex);
+  init_alloc_mutex();
+
+  block_header_t *header = (block_header_t *)__buf - 1;
+  int size_class = header->size_class;
+  thread_cache_t *cache = get_cache();
+
+  if (size_class == LARGE_BLOCK || cache == NULL) {
+    // Make the free call guarded by the mutex
+    mutex_lock(&alloc_mutex);
+    _free(header);
+    mutex_unlock(&alloc_mutex);
+    return;
+  }
+
+  // Put the block in our cache
+  void **payload = __buf;
+  *payload = cache->free_lists[size_class];
+  cache->free_lists[size_class] = payload;
+
+  if (++cache->nb_free[size_class] > CACHE_MAX_BLOCKS) {
+    // Our cache is too large, give half of it back to the heap
+    flush(cache, size_class, CACHE_MAX_BLOCKS / 2);
+  }
 }
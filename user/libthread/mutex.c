@@ -6,8 +6,11 @@
 #include <mutex.h>
 #include <simics.h>
 #include <mutex_asm.h>
+#include <atomic_ops.h>
 #include <syscall.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <thr_internals.h>
 
 /** @brief A state of the mutex which means that mutex_init hasn't been called
  *   after a mutex_destroy
@@ -19,6 +22,197 @@
  */
 #define MUTEX_INITIALIZED 1
 
+/** @brief A macro for considering 1 as true
+ */
+#define TRUE 1
+
+/** @brief Number of times a thread checks whether its ticket is being served
+ *   before it gives up spinning and deschedules itself
+ */
+#define MUTEX_SPIN_LIMIT 64
+
+/** @brief Difference between two consecutive tickets. Tickets are even, so
+ *   that the lowest bit of prev is free for MUTEX_SLEEPER
+ */
+#define MUTEX_TICKET 2
+
+/** @brief Bit of prev set when the thread holding the ticket after the
+ *   owner's is descheduled on the list of waiters, and must be woken up by
+ *   the owner when it unlocks the mutex
+ */
+#define MUTEX_SLEEPER 1
+
+/** @brief Get the ticket of the owner of a mutex from its prev field
+ */
+#define OWNER_TICKET(prev) (((prev) & ~MUTEX_SLEEPER) + MUTEX_TICKET)
+
+/** @brief Content of an empty slot in a mutex's ring of kernel tids
+ */
+#define NO_TID -1
+
+/** @brief Get the ring slot of a ticket
+ */
+#define TID_SLOT(ticket) \
+  (((unsigned int)(ticket) / MUTEX_TICKET) % MUTEX_TID_RING_SIZE)
+
+/** @brief Removes the waiter holding a particular ticket from a mutex's list
+ *   of descheduled threads
+ *
+ *  The caller must hold the mutex's waiters_lock.
+ *
+ *  @param mp The mutex
+ *  @param ticket The ticket of the waiter to remove
+ *
+ *  @return The removed waiter if it was in the list, NULL otherwise
+ */
+static waiter_t *remove_waiter(mutex_t *mp, int ticket) {
+
+  waiter_t **link = &mp->waiters;
+
+  // Loop over the list
+  while (*link != NULL) {
+    if ((*link)->ticket == ticket) {
+      waiter_t *waiter = *link;
+      *link = waiter->next;
+      return waiter;
+    }
+    link = &(*link)->next;
+  }
+
+  return NULL;
+}
+
+/** @brief Sets MUTEX_SLEEPER if the thread holding the ticket after the
+ *   owner's is on the list of waiters
+ *
+ *  The caller must hold the mutex's waiters_lock, and the owner must not be
+ *  able to unlock the mutex in the meantime (either it is the caller, or it
+ *  is a descheduled waiter the caller is handing the mutex to).
+ *
+ *  @param mp The mutex
+ *  @param ticket The ticket of the owner
+ *
+ *  @return void
+ */
+static void flag_successor(mutex_t *mp, int ticket) {
+
+  waiter_t *waiter;
+
+  for (waiter = mp->waiters; waiter != NULL; waiter = waiter->next) {
+    if (waiter->ticket == ticket + MUTEX_TICKET) {
+      atomic_exchange(&mp->prev, mp->prev | MUTEX_SLEEPER);
+      return;
+    }
+  }
+}
+
+/** @brief Makes sure that the thread holding the ticket after ours will be
+ *   woken up when we unlock a mutex we just acquired
+ *
+ *  A waiter which descheduled itself while we were not yet the owner could
+ *  not set MUTEX_SLEEPER for us, so we look for it on the list.
+ *
+ *  @param mp The mutex, owned by the caller
+ *  @param ticket The ticket of the caller
+ *
+ *  @return void
+ */
+static void claim_successor(mutex_t *mp, int ticket) {
+
+  if (*(waiter_t * volatile *)&mp->waiters == NULL) {
+    return;
+  }
+
+  spinlock_lock(&mp->waiters_lock);
+  flag_successor(mp, ticket);
+  spinlock_unlock(&mp->waiters_lock);
+}
+
+/** @brief Puts a waiter on the list of threads descheduled on a mutex
+ *
+ *  If the waiter holds the ticket after the owner's, MUTEX_SLEEPER is set so
+ *  that the owner wakes it up when unlocking. Otherwise the thread holding
+ *  the ticket before the waiter's sets it once it owns the mutex (see
+ *  claim_successor()).
+ *
+ *  @param mp The mutex
+ *  @param waiter The waiter, whose ticket is set
+ *
+ *  @return 0 if the waiter was put on the list, 1 if its ticket is already
+ *   being served, in which case it was not put on the list
+ */
+static int enqueue_waiter(mutex_t *mp, waiter_t *waiter) {
+
+  int ticket = waiter->ticket;
+
+  spinlock_lock(&mp->waiters_lock);
+  waiter->next = mp->waiters;
+  mp->waiters = waiter;
+
+  while (TRUE) {
+    // The locked read makes our place on the list visible to the owner
+    // before we look at the state of the mutex
+    int prev = atomic_add_and_update(&mp->prev, 0);
+
+    if (OWNER_TICKET(prev) == ticket) {
+      // The mutex was released before the unlocking thread could see us
+      remove_waiter(mp, ticket);
+      flag_successor(mp, ticket);
+      spinlock_unlock(&mp->waiters_lock);
+      return 1;
+    }
+
+    if (OWNER_TICKET(prev) + MUTEX_TICKET != ticket ||
+        (prev & MUTEX_SLEEPER)) {
+      // The owner is not our predecessor, it will flag us when it is
+      break;
+    }
+
+    // Ask the owner to wake us up, unless it just released the mutex
+    if (atomic_compare_and_swap(&mp->prev, prev, prev | MUTEX_SLEEPER) ==
+        prev) {
+      break;
+    }
+  }
+
+  spinlock_unlock(&mp->waiters_lock);
+  return 0;
+}
+
+/** @brief Yields to the owner of a mutex on behalf of a waiter which is
+ *   done spinning
+ *
+ *  The owner's kernel tid is looked up in the mutex's ring of kernel tids.
+ *  Its slot is only trusted if no later ticket can have been given out for
+ *  the same slot, i.e. if fewer than MUTEX_TID_RING_SIZE tickets separate
+ *  the owner's ticket from ours. Otherwise (or if the owner did not publish
+ *  its tid) we do not yield at all: the waiter is about to deschedule itself
+ *  anyway, which lets the owner run as well.
+ *
+ *  @param mp The mutex
+ *  @param my_ticket The waiter's ticket
+ *  @param my_kernel_tid The waiter's kernel tid, NO_TID if unknown
+ *
+ *  @return 1 if the waiter's ticket is being served, 0 otherwise
+ */
+static int yield_to_owner(mutex_t *mp, int my_ticket, int my_kernel_tid) {
+
+  int owner_ticket = OWNER_TICKET(*(volatile int *)&mp->prev);
+  if (owner_ticket == my_ticket) {
+    return 1;
+  }
+
+  unsigned int distance = (unsigned int)(my_ticket - owner_ticket);
+  if (distance < MUTEX_TID_RING_SIZE * MUTEX_TICKET) {
+    int owner_tid = mp->ticket_tids[TID_SLOT(owner_ticket)];
+    if (owner_tid != NO_TID && owner_tid != my_kernel_tid) {
+      yield(owner_tid);
+    }
+  }
+
+  return OWNER_TICKET(*(volatile int *)&mp->prev) == my_ticket;
+}
+
 /** @brief Initialize a mutex
  *
  *  This function initializes the mutex pointed to by mp.
@@ -39,8 +233,16 @@ int mutex_init(mutex_t *mp) {
 
   // Initialize the state for the mutex
   mp->prev = 0;
-  mp->next_ticket = 1;
+  mp->next_ticket = MUTEX_TICKET;
   mp->init = MUTEX_INITIALIZED;
+  mp->waiters = NULL;
+  int i;
+  for (i = 0; i < MUTEX_TID_RING_SIZE; ++i) {
+    mp->ticket_tids[i] = NO_TID;
+  }
+  if (spinlock_init(&mp->waiters_lock) < 0) {
+    return -1;
+  }
 
   return 0;
 }
@@ -64,13 +266,12 @@ void mutex_destroy(mutex_t *mp) {
   // Illegal Operation. Destroy on an uninitalized mutex
   assert(mp->init == MUTEX_INITIALIZED);
 
-  int j = 1;
-
   // Generate a new ticket for this thread
-  int my_ticket = atomic_add_and_update(&mp->next_ticket, j);
+  int my_ticket = atomic_add_and_update(&mp->next_ticket, MUTEX_TICKET);
 
   // Ensure that no other thread is locked or trying to lock this mutex
-  assert((mp->prev + 1) == my_ticket);  
+  assert((mp->prev + MUTEX_TICKET) == my_ticket);
+  assert(mp->waiters == NULL);
 
   // Reset the mutex state
   mp->init = MUTEX_UNINITIALIZED;
@@ -81,6 +282,11 @@ void mutex_destroy(mutex_t *mp) {
  *  A call to this function ensures mutual exclusion in the
  *  region between itself and a call to mutex unlock().
  *
+ *  The calling thread first spins for a bounded amount of time waiting for
+ *  its ticket to be served. If that is not enough, it puts itself on the
+ *  mutex's list of waiters and deschedules itself. The thread releasing the
+ *  mutex then wakes up exactly the thread holding the next ticket.
+ *
  *  @param mp The mutex holding the lock we want to acquire
  *
  *  @return void
@@ -90,17 +296,54 @@ void mutex_lock(mutex_t *mp) {
   // Validate parameter and the fact that the mutex is initialized
   assert(mp && mp->init == MUTEX_INITIALIZED);
 
-  int j = 1;
-
   // Generate a new ticket for this thread
-  int my_ticket = atomic_add_and_update(&mp->next_ticket, j);
+  int my_ticket = atomic_add_and_update(&mp->next_ticket, MUTEX_TICKET);
+
+  // Let the other threads know who holds this ticket (if we already know
+  // our kernel tid, the slot is only a hint)
+  int my_kernel_tid = thr_get_my_kernel_id_nolock();
+  mp->ticket_tids[TID_SLOT(my_ticket)] = my_kernel_tid;
+
+  // Spin for a little while, the mutex is often released quickly
+  int spins;
+  for (spins = 0; spins < MUTEX_SPIN_LIMIT; ++spins) {
+    if (OWNER_TICKET(*(volatile int *)&mp->prev) == my_ticket) {
+      claim_successor(mp, my_ticket);
+      return;
+    }
+    cpu_relax();
+  }
 
-  while((mp->prev + 1) != my_ticket) {
-    // A thread which acquired the mutex earlier is running
-    // Yield till it releases the lock
-    yield(-1);
+  // The owner is probably not running, give it our time slice
+  if (yield_to_owner(mp, my_ticket, my_kernel_tid)) {
+    claim_successor(mp, my_ticket);
+    return;
   }
 
+  // Prepare to block until our ticket is served
+  if (my_kernel_tid == NO_TID) {
+    my_kernel_tid = gettid();
+  }
+  waiter_t waiter;
+  waiter.kernel_tid = my_kernel_tid;
+  waiter.ticket = my_ticket;
+  waiter.wakeup = 0;
+
+  if (enqueue_waiter(mp, &waiter) == 1) {
+    // The mutex was released in the meantime
+    return;
+  }
+
+  // Sleep until the unlocking thread tells us it is our turn
+  while (!waiter.wakeup) {
+    deschedule((int *)&waiter.wakeup);
+  }
+
+  // Wait for the unlocking thread to be done with its make_runnable() call
+  spinlock_lock(&mp->waiters_lock);
+  spinlock_unlock(&mp->waiters_lock);
+
+  assert(OWNER_TICKET(mp->prev) == my_ticket);
 }
 
 /** @brief Gives up the lock on a mutex
@@ -108,6 +351,14 @@ void mutex_lock(mutex_t *mp) {
  *  The calling thread gives up its claim to the lock. It is illegal
  *  for an application to unlock a mutex that is not locked.
  *
+ *  The mutex is released with a single atomic exchange. Unless the thread
+ *  holding the next ticket has descheduled itself, this is the last access
+ *  to the mutex, so that its memory can be freed by the next owner as soon
+ *  as it is released. Otherwise the next owner is made runnable and we
+ *  yield directly to it, so that the lock is handed off without waiting for
+ *  the scheduler to run the right thread. A next owner which is still
+ *  spinning is left alone.
+ *
  *  @param mp The mutex to which the lock belongs
  *
  *  @return void
@@ -117,6 +368,66 @@ void mutex_unlock(mutex_t *mp) {
   // Validate parameter and the fact that the mutex is initialized
   assert(mp && mp->init == MUTEX_INITIALIZED);
 
-  // Increment the prev value which stores the ticket of the last run thread
-  mp->prev++;
+  // Our ticket is done, clear its slot
+  int my_ticket = OWNER_TICKET(*(volatile int *)&mp->prev);
+  mp->ticket_tids[TID_SLOT(my_ticket)] = NO_TID;
+
+  // Release the mutex, prev now stores our ticket as the last served one
+  int prev = atomic_exchange(&mp->prev, my_ticket);
+
+  if (!(prev & MUTEX_SLEEPER)) {
+    // Nobody has to be woken up, the next owner (if any) is spinning and
+    // will see the lock is free without our help
+    return;
+  }
+
+  // The next owner is descheduled. It can not go on before we release the
+  // spinlock, so the mutex is still alive
+  int next = my_ticket + MUTEX_TICKET;
+  spinlock_lock(&mp->waiters_lock);
+  waiter_t *waiter = remove_waiter(mp, next);
+  assert(waiter != NULL);
+
+  // Make sure the new owner wakes up its own successor
+  flag_successor(mp, next);
+
+  // We can not touch the waiter anymore once its flag is set
+  int next_tid = waiter->kernel_tid;
+  waiter->wakeup = 1;
+
+  // Wake up the next owner of the mutex. This is done while holding the
+  // spinlock, which the woken thread takes before going on, so that this
+  // call can never wake it up later from an unrelated deschedule()
+  make_runnable(next_tid);
+  spinlock_unlock(&mp->waiters_lock);
+
+  // Hand off the lock to the next owner
+  yield(next_tid);
+}
+
+/** @brief Moves a blocked thread onto the list of threads waiting for a mutex
+ *
+ *  The waiter is given a ticket and put on the mutex's list of waiters on its
+ *  behalf, exactly as if it had called mutex_lock() and descheduled itself.
+ *  It is then woken up by mutex_unlock() when its ticket is served, at which
+ *  point it owns the mutex. This is used by cond_broadcast() so that woken
+ *  up threads do not all contend for the mutex at the same time.
+ *
+ *  @param mp The mutex
+ *  @param waiter The blocked thread
+ *
+ *  @return 0 if the waiter was put on the list, 1 if its ticket is already
+ *   being served, in which case the caller must wake it up itself
+ */
+int mutex_requeue_waiter(mutex_t *mp, waiter_t *waiter) {
+
+  // Validate parameter and the fact that the mutex is initialized
+  assert(mp && mp->init == MUTEX_INITIALIZED && waiter);
+
+  // Generate a new ticket for the waiting thread
+  int ticket = atomic_add_and_update(&mp->next_ticket, MUTEX_TICKET);
+  mp->ticket_tids[TID_SLOT(ticket)] = waiter->kernel_tid;
+  waiter->ticket = ticket;
+
+  return enqueue_waiter(mp, waiter);
 }
@@ -2,5 +2,6 @@
 #define _SPINLOCK_ASM_H_
 
 int atomic_add_and_update(int *i, int j);
+void cpu_relax(void);
 
 #endif
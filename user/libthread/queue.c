@@ -12,29 +12,6 @@
 #include <stdlib.h>
 #include <mutex.h>
 
-/** @brief Makes a generic_node_t type node to be added in the queue
- *
- *  @param value The value to be stored in the list casted as void*
- *
- *  @return NULL on error, or a pointer to the generic_node_t type new node
- */
-static generic_node_t *make_node(void *value) {
-
-  // Allocate the space for the new node
-  generic_node_t *new_node = (generic_node_t *)malloc(sizeof(generic_node_t));
-
-  if (!new_node) {
-    // malloc error
-    return NULL;
-  }
-
-  // Set the appropriate values for the node
-  new_node->value = value;
-  new_node->next = NULL;
-
-  return new_node;
-}
-
 /** @brief Initialize the queue
  *
  *  @param list The queue to be initialized
@@ -71,7 +48,7 @@ int queue_init(generic_queue_t *list) {
 int queue_insert_node(generic_queue_t *list, void *value) {
 
   // Make a new node
-  generic_node_t *new_node = make_node(value);
+  generic_node_t *new_node = generic_node_alloc(value);
 
   if (!new_node) {
     // Error creating a new node
@@ -87,7 +64,7 @@ int queue_insert_node(generic_queue_t *list, void *value) {
   if (!head || !tail) {
     // Invalid double pointer
     mutex_unlock(&list->mp);
-    free(new_node);
+    generic_node_free(new_node);
     return -1;
   }
 
@@ -153,7 +130,7 @@ void *queue_delete_node(generic_queue_t *list) {
   mutex_unlock(&list->mp);
 
   // Free the space for deleted node
-  free(tmp);
+  generic_node_free(tmp);
   tmp = NULL;
 
   return ret;
@@ -1,21 +1,51 @@
 /** @file rwlock.c
  *
  *  @brief This file contains the definitions for reader writer functions
- *   It implements rwlock_init, rwlock_lock, rwlock_unlock, rwlock_destroy
- *   and rwlock_downgrade which can be used by applications for synchronization
- *   The lock implemented here gives the writers priority and no reader is 
- *   allowed to start reading if the user is waiting for the lock. This 
- *   implementation can result in starvation of readers for now.
+ *   It implements rwlock_init, rwlock_lock, rwlock_unlock, rwlock_destroy,
+ *   rwlock_downgrade, rwlock_upgrade and rwlock_set_policy which can be used
+ *   by applications for synchronization.
+ *
+ *   The lock is a lock word packing the number of readers, a writer bit, an
+ *   upgrader bit and a waiters bit. An uncontended lock or unlock is a single
+ *   atomic instruction on that word. When the lock can not be taken, or when
+ *   threads are waiting, the helpers in rwlock_helper.c take the lock's mutex
+ *   and use its condition variables. By default the lock gives the writers
+ *   priority and no reader is allowed to start reading if a writer is waiting
+ *   for the lock, which can starve the readers. The RWLOCK_PHASE_FAIR policy
+ *   alternates read and write phases instead.
+ *
+ *   Under the RWLOCK_READER_BIASED policy, readers rather mark an entry of
+ *   their own TCB with the lock, and writers clear the lock's reader_bias
+ *   flag and wait for the entries of every TCB marked with it to be cleared.
+ *   The flag and the entries are both written to and then read back by each
+ *   side, with an atomic exchange in between, so either the reader sees the
+ *   flag cleared and backs off, or the writer sees the entry marked.
  *
  *  @author akanjani, lramire1
  */
 
 #include <rwlock.h>
+#include <rwlock_policy.h>
+#include <rwlock_upgrade.h>
+#include <thread.h>
 #include <mutex.h>
 #include <cond.h>
 #include <simics.h>
 #include <assert.h>
+#include <atomic_ops.h>
+#include <mutex_asm.h>
+#include <syscall.h>
+#include <stdlib.h>
 #include <rwlock_helper.h>
+#include <thr_internals.h>
+
+/** @brief A macro for considering 1 as true
+ */
+#define TRUE 1
+
+/** @brief A macro for considering 0 as false
+ */
+#define FALSE 0
 
 /** @brief A state of a reader writer lock meaning that a rwlock_destroy has
  *   not been called after a rwlock_init as of now.
@@ -27,11 +57,140 @@
  */
 #define RWLOCK_UNINITIALIZED 0
 
-/** @brief A type of the current operation being performed by threads holding
- *   the lock. This value is set when rwlock_init has been called and no 
- *   threads currently hold any locks
+/** @brief Initializes the entries of a new thread's TCB holding the reader
+ *   biased locks it reads
+ *
+ *  @param tcb The thread's TCB
+ *
+ *  @return void
+ */
+void rwlock_biased_reads_init(tcb_t *tcb) {
+
+  int i;
+  for (i = 0; i < RWLOCK_BIASED_READS; ++i) {
+    tcb->biased_reads[i] = NULL;
+  }
+}
+
+/** @brief Tries to take a reader biased lock for reading by marking an entry
+ *   of the calling thread's TCB
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return TRUE if the lock was taken, FALSE if the thread has to go
+ *   through the lock word
+ */
+static int start_biased_read(rwlock_t *rwlock) {
+
+  tcb_t *tcb = get_tcb();
+  if (tcb == NULL) {
+    // thr_init() was not called yet
+    return FALSE;
+  }
+
+  int i;
+  for (i = 0; i < RWLOCK_BIASED_READS; ++i) {
+    if (tcb->biased_reads[i] == NULL) {
+      break;
+    }
+  }
+  if (i == RWLOCK_BIASED_READS) {
+    // We are already reading as many locks this way as we can
+    return FALSE;
+  }
+
+  // Mark the entry before checking that writers did not clear the bias
+  atomic_exchange((int *)&tcb->biased_reads[i], (int)rwlock);
+  if (rwlock->reader_bias) {
+    return TRUE;
+  }
+
+  // A writer is revoking the bias
+  tcb->biased_reads[i] = NULL;
+  return FALSE;
+}
+
+/** @brief Gives up a reader biased lock if the calling thread took it for
+ *   reading through an entry of its TCB
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return TRUE if the lock was given up, FALSE if the thread holds it
+ *   through the lock word
+ */
+static int stop_biased_read(rwlock_t *rwlock) {
+
+  tcb_t *tcb = get_tcb();
+  if (tcb == NULL) {
+    return FALSE;
+  }
+
+  int i;
+  for (i = 0; i < RWLOCK_BIASED_READS; ++i) {
+    if (tcb->biased_reads[i] == rwlock) {
+      tcb->biased_reads[i] = NULL;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/** @brief Counts a read lock taken through the lock word of a reader biased
+ *   lock, setting the bias again once enough of them were taken since a
+ *   writer cleared it
+ *
+ *  The calling thread holds the lock for reading, so no writer can be
+ *  between taking the lock word and checking the bias. The count is not
+ *  exact when readers race, which only delays or hastens the bias.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return void
+ */
+static void count_unbiased_read(rwlock_t *rwlock) {
+
+  if (!rwlock->reader_bias && --rwlock->bias_inhibit <= 0) {
+    rwlock->reader_bias = TRUE;
+  }
+}
+
+/** @brief Clears the reader bias of a lock and waits for the readers which
+ *   took it through an entry of their TCB to give it up
+ *
+ *  The calling thread holds the lock word for writing, so no reader sets the
+ *  bias again in the meantime. The TCBs of all the threads are found in the
+ *  TCB directory. A thread which is not in it yet (or whose slot was not
+ *  scanned yet) can only mark an entry after the bias was cleared, and
+ *  then backs off.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return void
  */
-#define RWLOCK_INVALID 2
+static void revoke_bias(rwlock_t *rwlock) {
+
+  // Clear the bias before looking at the readers
+  atomic_exchange((int *)&rwlock->reader_bias, FALSE);
+  rwlock->bias_inhibit = RWLOCK_BIAS_INHIBIT;
+
+  int nb_slots = tcb_directory_nb_slots(&task.tcbs);
+
+  int index;
+  for (index = 0; index < nb_slots; ++index) {
+    tcb_t *tcb = tcb_directory_get_at(&task.tcbs, index);
+    if (tcb == NULL) {
+      continue;
+    }
+
+    int i;
+    for (i = 0; i < RWLOCK_BIASED_READS; ++i) {
+      while (tcb->biased_reads[i] == rwlock) {
+        yield(-1);
+      }
+    }
+  }
+}
 
 /** @brief Initializes a reader writer lock
  *
@@ -60,16 +219,24 @@ int rwlock_init(rwlock_t *rwlock) {
   mutex_lock(&rwlock->lock);
 
   if (cond_init(&rwlock->read_cvar) < 0 ||
-      cond_init(&rwlock->write_cvar) < 0) {
+      cond_init(&rwlock->write_cvar) < 0 ||
+      cond_init(&rwlock->upgrade_cvar) < 0) {
     // Condition variable init failed
     return -1;
   }
 
   // Initialize the state of the reader writer lock
   rwlock->init = RWLOCK_INITIALIZED;
-  rwlock->waiting_readers = rwlock->active_readers = 0;
-  rwlock->waiting_writers = rwlock->active_writers = 0;
-  rwlock->curr_op = RWLOCK_INVALID;
+  rwlock->state = 0;
+  rwlock->waiting_readers = rwlock->waiting_writers = 0;
+  rwlock->waiting_upgraders = 0;
+  rwlock->upgrade_pending = FALSE;
+  rwlock->upgrader = -1;
+  rwlock->reader_grant = 0;
+  rwlock->read_phase = 0;
+  rwlock->policy = RWLOCK_WRITER_PREFERRING;
+  rwlock->reader_bias = FALSE;
+  rwlock->bias_inhibit = 0;
 
   // Unlock the mutex. We are done
   mutex_unlock(&rwlock->lock);
@@ -80,17 +247,26 @@ int rwlock_init(rwlock_t *rwlock) {
 /** @brief Takes a lock to access the resource based on its type.
  *
  *  The type parameter is required to be either RWLOCK READ (for a shared 
- *  lock) or RWLOCK WRITE (for an exclusive lock). This function blocks 
- *  the calling thread until it has been granted the requested form of access.
+ *  lock), RWLOCK WRITE (for an exclusive lock) or RWLOCK_UPGRADABLE (for a
+ *  shared lock which at most one thread holds at a time, and which it can
+ *  upgrade to an exclusive lock). This function blocks the calling thread
+ *  until it has been granted the requested form of access.
+ *
+ *  A reader adds itself to the lock word as long as no writer has the lock
+ *  and no thread is waiting, and a writer takes a free lock word, without
+ *  taking the mutex. A reader of a reader biased lock first tries to mark an
+ *  entry of its TCB, and a writer of such a lock then revokes the bias.
  *
  *  @param rwlock A pointer to the reader writer lock
- *  @param type RWLOCK READ for a reader and RWLOCK WRITE for a writer
+ *  @param type RWLOCK READ for a reader, RWLOCK WRITE for a writer and
+ *   RWLOCK_UPGRADABLE for an upgrader
  *
  *  @return void
  */
 void rwlock_lock(rwlock_t *rwlock, int type) {
 
-  if (!rwlock || (type != RWLOCK_READ && type != RWLOCK_WRITE)) {
+  if (!rwlock || (type != RWLOCK_READ && type != RWLOCK_WRITE &&
+                  type != RWLOCK_UPGRADABLE)) {
     // Invalid parameter(s)
     return;
   }
@@ -98,28 +274,72 @@ void rwlock_lock(rwlock_t *rwlock, int type) {
   // Assert that the rwlock is initialized when this function is called
   assert(rwlock->init == RWLOCK_INITIALIZED);
 
-  if (type == RWLOCK_READ) {
+  if (type != RWLOCK_WRITE) {
     // The thread wants to read
-    start_read(rwlock);
+    if (type == RWLOCK_READ && rwlock->reader_bias &&
+        start_biased_read(rwlock) == TRUE) {
+      return;
+    }
+
+    // The upgrader thread sets its own bit instead of adding a reader
+    int hold = RWLOCK_READER;
+    int busy = RWLOCK_WRITER | RWLOCK_WAITERS;
+    if (type == RWLOCK_UPGRADABLE) {
+      hold = RWLOCK_UPGRADER;
+      busy |= RWLOCK_UPGRADER;
+    }
+
+    int state = rwlock->state;
+    while ((state & busy) == 0) {
+      int old_state = atomic_compare_and_swap((int *)&rwlock->state, state,
+                                              state + hold);
+      if (old_state == state) {
+        break;
+      }
+      // Another reader came or left in the meantime
+      state = old_state;
+    }
+    if ((state & busy) != 0) {
+      start_read(rwlock, type);
+    }
+
+    if (type == RWLOCK_UPGRADABLE) {
+      rwlock->upgrader = thr_getid();
+    }
+
+    if (rwlock->policy & RWLOCK_READER_BIASED) {
+      count_unbiased_read(rwlock);
+    }
   } else {
     // The thread wants to write
-    start_write(rwlock);
+    if (atomic_compare_and_swap((int *)&rwlock->state, 0,
+                                RWLOCK_WRITER) != 0) {
+      start_write(rwlock);
+    }
+
+    if (rwlock->reader_bias) {
+      revoke_bias(rwlock);
+    }
   }
 }
 
 /** @brief This function indicates that the calling thread is done using the 
  *   locked state in whichever mode it was granted access for. 
  *
+ *  The writer bit of the lock word tells which mode that is, as no reader
+ *  can hold the lock while a writer does. If the upgrader bit is set, the
+ *  upgrader thread is recognized by its tid.
+ *
  *  If the current lock being given up is an exclusive lock( writer was 
- *  runnning), then we check if another writer is waiting for this lock or
- *  not. If yes, we give the lock to that writer. Otherwise, we make all the
- *  reader threads waiting on this reader writer lock runnable
+ *  runnning), then we clear the lock word if no thread is waiting. Otherwise,
+ *  we check if another writer is waiting for this lock or not. If yes, we
+ *  give the lock to that writer. Otherwise, we make all the reader threads
+ *  waiting on this reader writer lock runnable
  *
  *  If the current lock being given up is an shared lock( reader was 
- *  running), then we check if this is the last of the running threads or not.
- *  If it isn't, we do not do anything. Otherwise, we check if any writer is
- *  waiting and if that's true, we give the writer the lock. Otherwise, we 
- *  continue;
+ *  running), then we remove the reader from the lock word. If this was the
+ *  last of the running threads and threads are waiting, we check if any
+ *  writer is waiting and if that's true, we give the writer the lock.
  *
  *  @param rwlock A pointer to the reader writer lock
  *
@@ -135,21 +355,47 @@ void rwlock_unlock(rwlock_t *rwlock) {
   // Assert that the rwlock is initialized when this function is called
   assert(rwlock->init == RWLOCK_INITIALIZED);
 
-  // Take the lock to check state
-  mutex_lock(&rwlock->lock);
+  if ((rwlock->policy & RWLOCK_READER_BIASED) &&
+      stop_biased_read(rwlock) == TRUE) {
+    // This thread was a reader, marked in its TCB
+    return;
+  }
 
-  // Assert that at least one thread is actively running with this lock
-  assert(rwlock->active_readers != 0 || rwlock->active_writers != 0);
+  int state = rwlock->state;
 
-  // Unlock the lock as we are done accessing state
-  mutex_unlock(&rwlock->lock);
+  // Assert that at least one thread is actively running with this lock
+  assert((state & (RWLOCK_WRITER | RWLOCK_UPGRADER)) ||
+         RWLOCK_NB_READERS(state) > 0);
 
-  if (rwlock->curr_op == RWLOCK_READ) {
-    // This thread was a reader
-    stop_read(rwlock);
-  } else {
+  if (state & RWLOCK_WRITER) {
     // This thread was a writer
-    stop_write(rwlock);
+    if (atomic_compare_and_swap((int *)&rwlock->state, RWLOCK_WRITER,
+                                0) != RWLOCK_WRITER) {
+      // Threads are waiting
+      stop_write(rwlock);
+    }
+  } else if ((state & RWLOCK_UPGRADER) && rwlock->upgrader == thr_getid()) {
+    // This thread was the upgrader. Forget about it before giving up the
+    // lock, so that it is not mistaken for the next upgrader
+    rwlock->upgrader = -1;
+    while (!(state & RWLOCK_WAITERS)) {
+      int old_state = atomic_compare_and_swap((int *)&rwlock->state, state,
+                                              state & ~RWLOCK_UPGRADER);
+      if (old_state == state) {
+        return;
+      }
+      // A reader came or left in the meantime
+      state = old_state;
+    }
+    // Threads are waiting
+    stop_upgradable(rwlock);
+  } else {
+    // This thread was a reader
+    state = atomic_add_and_update((int *)&rwlock->state, -RWLOCK_READER);
+    if ((state & RWLOCK_WAITERS) && RWLOCK_NB_READERS(state) == 1) {
+      // We were the last reader and threads are waiting
+      stop_read(rwlock);
+    }
   }
 }
 
@@ -178,12 +424,14 @@ void rwlock_destroy(rwlock_t *rwlock) {
   mutex_lock(&rwlock->lock);
 
   // Assert that there is no thread currently waiting/running for this rwlock
-  assert(rwlock->active_readers == 0 && rwlock->active_writers == 0); 
+  assert(rwlock->state == 0);
   assert(rwlock->waiting_readers == 0 && rwlock->waiting_writers == 0);
+  assert(rwlock->waiting_upgraders == 0);
 
   // Destroy the condition variables
   cond_destroy(&rwlock->read_cvar);
   cond_destroy(&rwlock->write_cvar);
+  cond_destroy(&rwlock->upgrade_cvar);
   
   // Reset the initialized state
   rwlock->init = RWLOCK_UNINITIALIZED;
@@ -215,25 +463,37 @@ void rwlock_downgrade(rwlock_t *rwlock) {
     return;
   }
 
-  if (rwlock->active_writers <= 0) {
+  int state = rwlock->state;
+
+  if (!(state & RWLOCK_WRITER)) {
     // No writer is running
     return;
   }
 
+  // Turn ourselves into a reader right away if no thread is waiting
+  if (atomic_compare_and_swap((int *)&rwlock->state, RWLOCK_WRITER,
+                              RWLOCK_READER) == RWLOCK_WRITER) {
+    return;
+  }
+
   // Lock the mutex to modify state
   mutex_lock(&rwlock->lock);
 
-  // Decrement the number of active_writers
-  rwlock->active_writers--;
-
-  // Assert that there is now no active_writer
-  assert(rwlock->active_writers == 0);
-
-  // Increment the number of active readers
-  rwlock->active_readers++;
+  // Replace the writer by a reader, without releasing the lock in between
+  int old_state;
+  state = rwlock->state;
+  while ((old_state = atomic_compare_and_swap((int *)&rwlock->state, state,
+                               (state & ~RWLOCK_WRITER) + RWLOCK_READER))
+         != state) {
+    state = old_state;
+  }
 
-  // Set the current operation being performed as read
-  rwlock->curr_op = RWLOCK_READ;
+  if (rwlock->policy & RWLOCK_PHASE_FAIR) {
+    // Start a read phase for the readers waiting now
+    rwlock->read_phase++;
+    rwlock->reader_grant = rwlock->waiting_readers +
+                           rwlock->waiting_upgraders;
+  }
 
   // Broadcast to all reader threads waiting for the read_cvar
   cond_broadcast(&rwlock->read_cvar);
@@ -241,3 +501,79 @@ void rwlock_downgrade(rwlock_t *rwlock) {
   // Unlock the mutex. We are done
   mutex_unlock(&rwlock->lock);
 }
+
+/** @brief A thread may call this function only if it holds the lock in
+ *   RWLOCK_UPGRADABLE mode, when it turns out to need exclusive access to
+ *   the protected resource. The function waits for the threads holding the
+ *   lock in RWLOCK_READ mode to release it, new readers waiting meanwhile,
+ *   and returns with the invoking thread holding the lock in RWLOCK_WRITE
+ *   mode. The lock is at no time unlocked, so what the invoking thread read
+ *   remains valid. As only one thread holds the lock in RWLOCK_UPGRADABLE
+ *   mode, two upgrades can not wait for each other.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return void
+ */
+void rwlock_upgrade(rwlock_t *rwlock) {
+
+  if (!rwlock) {
+    // Invalid parameter
+    return;
+  }
+
+  // Illegal operation. The thread does not hold the upgradable read lock
+  assert((rwlock->state & RWLOCK_UPGRADER) &&
+         rwlock->upgrader == thr_getid());
+
+  rwlock->upgrader = -1;
+
+  // Turn ourselves into a writer right away if no other thread is around
+  if (atomic_compare_and_swap((int *)&rwlock->state, RWLOCK_UPGRADER,
+                              RWLOCK_WRITER) != RWLOCK_UPGRADER) {
+    start_upgrade(rwlock);
+  }
+
+  if (rwlock->reader_bias) {
+    revoke_bias(rwlock);
+  }
+}
+
+/** @brief Chooses the policy of a reader writer lock
+ *
+ *  This may only be called while no thread holds or waits on the lock,
+ *  usually right after rwlock_init.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *  @param policy RWLOCK_WRITER_PREFERRING or RWLOCK_PHASE_FAIR, possibly
+ *   combined with RWLOCK_READER_BIASED
+ *
+ *  @return Zero on success, a negative number on error
+ */
+int rwlock_set_policy(rwlock_t *rwlock, int policy) {
+
+  int order = policy & ~RWLOCK_READER_BIASED;
+  if (!rwlock || (order != RWLOCK_WRITER_PREFERRING &&
+                  order != RWLOCK_PHASE_FAIR)) {
+    // Invalid parameter(s)
+    return -1;
+  }
+
+  // Assert that the rwlock is initialized when this function is called
+  assert(rwlock->init == RWLOCK_INITIALIZED);
+
+  // Lock the mutex to modify state
+  mutex_lock(&rwlock->lock);
+
+  // Illegal operation. Changing the policy of a lock in use
+  assert(rwlock->state == 0);
+
+  rwlock->policy = policy;
+  rwlock->reader_bias = (policy & RWLOCK_READER_BIASED) ? TRUE : FALSE;
+  rwlock->bias_inhibit = 0;
+
+  // Unlock the mutex. We are done
+  mutex_unlock(&rwlock->lock);
+
+  return 0;
+}
@@ -3,13 +3,23 @@
  *  @brief This file contains the definitions for helper functions for 
  *   the reader writer locks
  *
+ *  These functions are the slow path of the lock, taken when its lock word
+ *  shows that the lock can not be acquired or that threads are waiting. The
+ *  waiting threads set the RWLOCK_WAITERS bit of the lock word while holding
+ *  the lock's mutex, and the bit is only cleared by the last of them to leave.
+ *  As long as it is set, the fast paths fail and releasing threads come here
+ *  to wake the waiting threads up, so no wakeup can be missed.
+ *
  *  @author akanjani, lramire1
  */
 
 #include <rwlock.h>
+#include <rwlock_policy.h>
+#include <rwlock_upgrade.h>
 #include <mutex.h>
 #include <cond.h>
 #include <assert.h>
+#include <atomic_ops.h>
 #include <rwlock_helper.h>
 
 /** @brief A macro for considering 1 as true
@@ -20,37 +30,100 @@
  */
 #define FALSE 0
 
-/** @brief Entry point for a thread trying to get a read lock. 
+/** @brief Computes the lock word a thread leaving the slow path stores
+ *
+ *  The RWLOCK_WAITERS bit stays set if other threads are still waiting. The
+ *  caller must hold the lock's mutex and still be counted as waiting.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *  @param state  The lock word, with the calling thread's hold added
+ *
+ *  @return The lock word to store
+ */
+static int leaving_state(rwlock_t *rwlock, int state) {
+
+  state &= ~RWLOCK_WAITERS;
+  if (rwlock->waiting_readers + rwlock->waiting_writers +
+      rwlock->waiting_upgraders + rwlock->upgrade_pending > 1) {
+    state |= RWLOCK_WAITERS;
+  }
+  return state;
+}
+
+/** @brief Sets the RWLOCK_WAITERS bit of a lock word before the calling
+ *   thread waits on one of the lock's condition variables
+ *
+ *  The caller must hold the lock's mutex.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *  @param state  The lock word the calling thread saw
+ *
+ *  @return TRUE if the bit is set and the lock word is still the one the
+ *   calling thread saw, FALSE if it changed and must be checked again
+ */
+static int set_waiters(rwlock_t *rwlock, int state) {
+
+  if (state & RWLOCK_WAITERS) {
+    // Releasing threads will go through the mutex
+    return TRUE;
+  }
+  return atomic_compare_and_swap((int *)&rwlock->state, state,
+                                 state | RWLOCK_WAITERS) == state;
+}
+
+/** @brief Entry point for a thread trying to get a read lock or the
+ *   upgradable read lock, when the fast path failed
  *
  *  The function blocks until the current thread can run according to the
- *  writers priority case of reader writer problem. Increments the number
- *  of waiting_readers to indicate another thread is waiting to read on this
- *  lock. When the condition variable is signaled and we are allowed to run,
- *  we decrement the number of waiting readers and increment the number of 
- *  active readers. We also set the current operation to read.
+ *  policy of the lock. Increments the number of waiting_readers (or
+ *  waiting_upgraders) to indicate another thread is waiting to read on this
+ *  lock. When we are allowed to run, we add ourselves to the readers of the
+ *  lock word (or set its upgrader bit) and decrement the number of waiting
+ *  threads.
  *
  *  @param rwlock A pointer to the reader writer lock
+ *  @param type RWLOCK_READ for a reader and RWLOCK_UPGRADABLE for an upgrader
  *
  *  @return void
  */
-void start_read(rwlock_t *rwlock) {
+void start_read(rwlock_t *rwlock, int type) {
+
+  int *waiting = (type == RWLOCK_READ) ? &rwlock->waiting_readers :
+                                         &rwlock->waiting_upgraders;
+  int hold = (type == RWLOCK_READ) ? RWLOCK_READER : RWLOCK_UPGRADER;
 
   // Take a mutex before modifying state
   mutex_lock(&rwlock->lock);
 
   // Increment the number of waiting readers
-  rwlock->waiting_readers++;
+  (*waiting)++;
 
-  while(wait_for_read(rwlock) == TRUE) {
-    // We can't take the lock right now.
-    // Wait for the state to change and try again
-    cond_wait(&rwlock->read_cvar, &rwlock->lock);
+  // A read phase starting while we wait is ours
+  int phase = rwlock->read_phase;
+
+  while (TRUE) {
+    int state = rwlock->state;
+
+    if (wait_for_read(rwlock, state, type, phase) == FALSE) {
+      // Try to take the lock, which may fail if the last reader just left
+      int new_state = leaving_state(rwlock, state + hold);
+      if (atomic_compare_and_swap((int *)&rwlock->state, state,
+                                  new_state) == state) {
+        break;
+      }
+    } else if (set_waiters(rwlock, state) == TRUE) {
+      // We can't take the lock right now.
+      // Wait for the state to change and try again
+      cond_wait(&rwlock->read_cvar, &rwlock->lock);
+    }
   }
 
   // Update the new state
-  rwlock->waiting_readers--;
-  rwlock->active_readers++;
-  rwlock->curr_op = RWLOCK_READ;
+  (*waiting)--;
+  if (phase != rwlock->read_phase) {
+    // We were counted in the grant of the read phase
+    rwlock->reader_grant--;
+  }
 
   // Release the mutex. We are done
   mutex_unlock(&rwlock->lock);
@@ -58,32 +131,50 @@ void start_read(rwlock_t *rwlock) {
 
 /** @brief Checks if the current reader thread has to wait to get the lock. 
  *
- *  The functions checks if there is any current active writer threads
- *  running or waiting on this lock. If yes, we return TRUE as the writers
- *  get priority and no reader can run in this case.
- *
- *  Otherwise, we return FALSE
+ *  The functions checks if a writer thread has the lock, if another thread
+ *  has the upgradable read lock when we want it, or if the thread which has
+ *  it waits for the readers to leave. If yes, we return TRUE. Otherwise, if
+ *  a read phase started under the RWLOCK_PHASE_FAIR policy since the thread
+ *  started waiting, we return FALSE. Otherwise, we return TRUE if writer
+ *  threads are waiting on this lock, as the writers get priority over new
+ *  readers.
  *
  *  @param rwlock A pointer to the reader writer lock
+ *  @param state  The lock word
+ *  @param type RWLOCK_READ for a reader and RWLOCK_UPGRADABLE for an upgrader
+ *  @param phase  The read phase of the lock when the thread started waiting
  *
  *  @return TRUE if the reader thread has to wait. Otherwise, FALSE
  */
-int wait_for_read(rwlock_t *rwlock) {
+int wait_for_read(rwlock_t *rwlock, int state, int type, int phase) {
 
-  if (rwlock->active_writers > 0 || rwlock->waiting_writers > 0) {
+  if (state & RWLOCK_WRITER) {
+    return TRUE;
+  }
+  if (type == RWLOCK_UPGRADABLE && (state & RWLOCK_UPGRADER)) {
+    return TRUE;
+  }
+  if (rwlock->upgrade_pending) {
+    return TRUE;
+  }
+  if (phase != rwlock->read_phase) {
+    // We were waiting when the current read phase started
+    return FALSE;
+  }
+  if (rwlock->waiting_writers > 0) {
     return TRUE;
   }
   return FALSE;
 }
 
-/** @brief Entry point for a thread trying to get a write lock. 
+/** @brief Entry point for a thread trying to get a write lock, when the
+ *   fast path failed
  *
  *  The function blocks until the current thread can run according to the
- *  writers priority case of reader writer problem. Increments the number
- *  of waiting_writers to indicate another thread is waiting to write on this
- *  lock. When the condition variable is signaled and we are allowed to run,
- *  we decrement the number of waiting writers and increment the number of 
- *  active writers. We also set the current operation to write.
+ *  policy of the lock. Increments the number of waiting_writers to indicate
+ *  another thread is waiting to write on this lock. When we are allowed to
+ *  run, we set the writer bit of the lock word and decrement the number of
+ *  waiting writers.
  *
  *  @param rwlock A pointer to the reader writer lock
  *
@@ -97,16 +188,25 @@ void start_write(rwlock_t *rwlock) {
   // Increment the number of waiting writers
   rwlock->waiting_writers++;
 
-  while(wait_for_write(rwlock) == TRUE) {
-    // We can't take the lock right now.
-    // Wait for the state to change and try again
-    cond_wait(&rwlock->write_cvar, &rwlock->lock);
+  while (TRUE) {
+    int state = rwlock->state;
+
+    if (wait_for_write(rwlock, state) == FALSE) {
+      // Try to take the lock, which may fail if a reader just left
+      int new_state = leaving_state(rwlock, state | RWLOCK_WRITER);
+      if (atomic_compare_and_swap((int *)&rwlock->state, state,
+                                  new_state) == state) {
+        break;
+      }
+    } else if (set_waiters(rwlock, state) == TRUE) {
+      // We can't take the lock right now.
+      // Wait for the state to change and try again
+      cond_wait(&rwlock->write_cvar, &rwlock->lock);
+    }
   }
 
   // Update the new state
   rwlock->waiting_writers--;
-  rwlock->active_writers++;
-  rwlock->curr_op = RWLOCK_WRITE;
 
   // Release the mutex. We are done
   mutex_unlock( &rwlock->lock );
@@ -114,32 +214,36 @@ void start_write(rwlock_t *rwlock) {
 
 /** @brief Checks if the current writer thread has to wait to get the lock. 
  *
- *  The functions checks if there is any current active writer threads
- *  or reader threads for this lock. If yes, we return TRUE as the writer
- *  cannot run in this case. We will have to wait either for the 
- *  writer thread or multiple reader threads to finish before we can get
- *  the lock
+ *  The functions checks if there is any current active writer threads,
+ *  reader threads or upgrader thread for this lock, or waiting readers which
+ *  were granted a read phase. If yes, we return TRUE as the writer cannot run
+ *  in this case. We will have to wait either for the writer thread or
+ *  multiple reader threads to finish before we can get the lock
  *
  *  Otherwise, we return FALSE
  *
  *  @param rwlock A pointer to the reader writer lock
+ *  @param state  The lock word
  *
  *  @return TRUE if the writer thread has to wait. Otherwise, FALSE
  */
-int wait_for_write(rwlock_t *rwlock) {
+int wait_for_write(rwlock_t *rwlock, int state) {
 
-  if (rwlock->active_readers > 0 || rwlock->active_writers > 0) {
+  if ((state & (RWLOCK_WRITER | RWLOCK_UPGRADER)) ||
+      RWLOCK_NB_READERS(state) > 0 || rwlock->reader_grant > 0) {
     return TRUE;
   }
   return FALSE;
 }
 
-/** @brief Entry point for a thread trying to give up a read lock. 
+/** @brief Wakes up the threads waiting on a lock after the last reader
+ *   released it
  *
- *  The function decrements the number of active readers and then
- *  checks if there are no other active readers and there is a thread 
- *  waiting to get a write lock, we make the thread runnable by signalling
- *  the condition variable.  
+ *  The reader was already removed from the lock word. If the upgrader thread
+ *  waits for the readers to leave, we make it runnable. Otherwise, if there
+ *  is a thread waiting to get a write lock, we make it runnable by
+ *  signalling the condition variable. Readers only wait while writers or the
+ *  upgrader do.
  *
  *  @param rwlock A pointer to the reader writer lock
  *
@@ -147,16 +251,15 @@ int wait_for_write(rwlock_t *rwlock) {
  */
 void stop_read(rwlock_t *rwlock) {
 
-  // Take a mutex before modifying state
+  // Take a mutex before checking state
   mutex_lock(&rwlock->lock);
 
-  // Decrement the number of active readers
-  rwlock->active_readers--;
-
-  if (rwlock->active_readers == 0 && rwlock->waiting_writers > 0) {
-    // If no other readers are running and there is at least one thread
-    // waiting for a write lock, we signal the write_cvar so that the writer
-    // gets to run
+  if (rwlock->upgrade_pending) {
+    // The upgrader thread gets to write first
+    cond_signal(&rwlock->upgrade_cvar);
+  } else if (rwlock->waiting_writers > 0) {
+    // There is at least one thread waiting for a write lock, we signal the
+    // write_cvar so that the writer gets to run
     cond_signal(&rwlock->write_cvar);
   }
 
@@ -164,10 +267,14 @@ void stop_read(rwlock_t *rwlock) {
   mutex_unlock(&rwlock->lock);
 }
 
-/** @brief Entry point for a thread trying to give up a write lock. 
+/** @brief Entry point for a thread trying to give up a write lock while
+ *   threads are waiting on it
  *
- *  The function decrements the number of active writers and then
- *  checks if there are other threads waiting to get a write lock. If that
+ *  The function clears the writer bit of the lock word. Under the
+ *  RWLOCK_PHASE_FAIR policy, if readers are waiting, a read phase starts:
+ *  all of them (but not the readers arriving later) are granted the lock
+ *  ahead of the waiting writers and made runnable. Otherwise, we
+ *  check if there are other threads waiting to get a write lock. If that
  *  is the case, we make one of those waiting threads runnable in a FIFO 
  *  fashion. Otherwise, we make all the threads waiting to get a read lock
  *  runnable.
@@ -181,13 +288,23 @@ void stop_write(rwlock_t *rwlock) {
   // Take a mutex before modifying state
   mutex_lock(&rwlock->lock);
 
-  // Decrement the number of active writers
-  rwlock->active_writers--;
+  // Give up the lock
+  int state = rwlock->state;
+  int old_state;
+  while ((old_state = atomic_compare_and_swap((int *)&rwlock->state, state,
+                                              state & ~RWLOCK_WRITER))
+         != state) {
+    state = old_state;
+  }
 
-  // Assert that no writer is active now.
-  assert(rwlock->active_writers == 0);
+  int waiting_readers = rwlock->waiting_readers + rwlock->waiting_upgraders;
 
-  if (rwlock->waiting_writers > 0) {
+  if ((rwlock->policy & RWLOCK_PHASE_FAIR) && waiting_readers > 0) {
+    // Start a read phase for the readers waiting now
+    rwlock->read_phase++;
+    rwlock->reader_grant = waiting_readers;
+    cond_broadcast(&rwlock->read_cvar);
+  } else if (rwlock->waiting_writers > 0) {
     // At least one thread is waiting to acquire a write lock.
     // We should let that thread run
     cond_signal(&rwlock->write_cvar);
@@ -199,3 +316,85 @@ void stop_write(rwlock_t *rwlock) {
   // Release the mutex. We are done
   mutex_unlock(&rwlock->lock);
 }
+
+/** @brief Entry point for the upgrader thread trying to turn its upgradable
+ *   read lock into a write lock, when the fast path failed
+ *
+ *  The function blocks until the readers have left. New readers wait in the
+ *  meantime. As there is only one upgrader thread, the readers it waits for
+ *  never wait for another upgrade.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return void
+ */
+void start_upgrade(rwlock_t *rwlock) {
+
+  // Take a mutex before modifying state
+  mutex_lock(&rwlock->lock);
+
+  // Make the new readers wait
+  rwlock->upgrade_pending = TRUE;
+
+  while (TRUE) {
+    int state = rwlock->state;
+
+    if (RWLOCK_NB_READERS(state) == 0) {
+      // Swap the upgrader bit for the writer bit
+      int new_state = leaving_state(rwlock, (state & ~RWLOCK_UPGRADER) |
+                                            RWLOCK_WRITER);
+      if (atomic_compare_and_swap((int *)&rwlock->state, state,
+                                  new_state) == state) {
+        break;
+      }
+    } else if (set_waiters(rwlock, state) == TRUE) {
+      // Wait for the last reader to leave
+      cond_wait(&rwlock->upgrade_cvar, &rwlock->lock);
+    }
+  }
+
+  // Update the new state
+  rwlock->upgrade_pending = FALSE;
+
+  // Release the mutex. We are done
+  mutex_unlock(&rwlock->lock);
+}
+
+/** @brief Entry point for the upgrader thread trying to give up its
+ *   upgradable read lock while threads are waiting on it
+ *
+ *  The function clears the upgrader bit of the lock word. If no reader is
+ *  left and writers are waiting, one of them is made runnable. The threads
+ *  waiting for the upgradable read lock are made runnable too.
+ *
+ *  @param rwlock A pointer to the reader writer lock
+ *
+ *  @return void
+ */
+void stop_upgradable(rwlock_t *rwlock) {
+
+  // Take a mutex before modifying state
+  mutex_lock(&rwlock->lock);
+
+  // Give up the lock
+  int state = rwlock->state;
+  int old_state;
+  while ((old_state = atomic_compare_and_swap((int *)&rwlock->state, state,
+                                              state & ~RWLOCK_UPGRADER))
+         != state) {
+    state = old_state;
+  }
+
+  if (RWLOCK_NB_READERS(state) == 0 && rwlock->waiting_writers > 0) {
+    // The upgrader thread was the last one holding the lock
+    cond_signal(&rwlock->write_cvar);
+  }
+
+  if (rwlock->waiting_upgraders > 0) {
+    // Let the next upgrader thread check the lock again
+    cond_broadcast(&rwlock->read_cvar);
+  }
+
+  // Release the mutex. We are done
+  mutex_unlock(&rwlock->lock);
+}
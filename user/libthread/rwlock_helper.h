@@ -3,11 +3,40 @@
 
 #include <rwlock_type.h>
 
-int wait_for_read(rwlock_t *rwlock);
-void start_read(rwlock_t *rwlock);
-int wait_for_write(rwlock_t *rwlock);
+/** @brief Bit of a lock word set while a thread has the write lock
+ */
+#define RWLOCK_WRITER 1
+
+/** @brief Bit of a lock word set while threads are waiting in the slow path
+ */
+#define RWLOCK_WAITERS 2
+
+/** @brief Bit of a lock word set while a thread has the upgradable read
+ *   lock
+ */
+#define RWLOCK_UPGRADER 4
+
+/** @brief Amount a reader adds to a lock word, the number of readers being
+ *   stored above the bits
+ */
+#define RWLOCK_READER 8
+
+/** @brief The number of threads with the read lock in a lock word
+ */
+#define RWLOCK_NB_READERS(state) ((unsigned int)(state) / RWLOCK_READER)
+
+/** @brief Number of read locks taken through the lock word after a writer
+ *   cleared the reader bias, before readers set it again
+ */
+#define RWLOCK_BIAS_INHIBIT 1024
+
+int wait_for_read(rwlock_t *rwlock, int state, int type, int phase);
+void start_read(rwlock_t *rwlock, int type);
+int wait_for_write(rwlock_t *rwlock, int state);
 void start_write(rwlock_t *rwlock);
 void stop_read(rwlock_t *rwlock);
 void stop_write(rwlock_t *rwlock);
+void start_upgrade(rwlock_t *rwlock);
+void stop_upgradable(rwlock_t *rwlock);
 
 #endif /* _RWLOCK_HELPER_H */
@@ -4,15 +4,24 @@
  *   It implements sem_init, sem_wait, sem_signal and sem_destroy which
  *   can be used by applications for synchronization
  *
+ *   The number of available resources is updated with a single atomic
+ *   instruction, so sem_wait does not take any lock as long as a resource
+ *   is available, and sem_signal as long as no thread is waiting. A thread
+ *   which finds no resource left deschedules itself on the list of waiting
+ *   threads, and a sem_signal which finds threads waiting hands its resource
+ *   over to the first of them instead of making it available to all.
+ *
  *  @author akanjani, lramire1
  */
 
 #include <sem_type.h>
 #include <sem.h>
-#include <mutex.h>
-#include <cond.h>
+#include <syscall.h>
+#include <stdlib.h>
 #include <simics.h>
 #include <assert.h>
+#include <mutex_asm.h>
+#include <thr_internals.h>
 
 /** @brief A state of the semaphore which means that sem_destroy has not
  *   been called after a sem_init
@@ -45,27 +54,21 @@ int sem_init(sem_t *sem, int count) {
     return -1;
   }
 
-  // Initialize the mutex and the condition variable for this semaphore
-  if (mutex_init(&sem->lock) < 0 || cond_init(&sem->cvar) < 0) {
-    // failed to init the mutex for this semaphore
+  // Initialize the spinlock protecting the waiting threads
+  if (spinlock_init(&sem->waiters_lock) < 0) {
+    // failed to init the spinlock for this semaphore
     return -1;
   }
 
-  // Lock the mutex to ensure atomicity
-  mutex_lock(&sem->lock);
-
-  // Initialize the semaphore state
-  sem->init = SEM_INITIALIZED;
-
   // Initialize the number of available resources to the count paramter.
   sem->available_resources = count;
 
-  // Initialize the number of threads that have been woken up but are yet to 
-  // execute to 0
-  sem->wokenup_waiting = 0;
+  // No thread is waiting yet
+  sem->handoffs = 0;
+  sem->head = sem->tail = NULL;
 
-  // Unlock the mutex as the initialization is done
-  mutex_unlock(&sem->lock);
+  // Initialize the semaphore state
+  sem->init = SEM_INITIALIZED;
 
   return 0;
 }
@@ -76,6 +79,11 @@ int sem_init(sem_t *sem, int count) {
  *  and may cause it to block indefinitely until it is legal to 
  *  perform the decrement.
  *
+ *  If the value was positive, the thread takes a resource and returns right
+ *  away. Otherwise, it waits for a sem_signal to hand a resource over to
+ *  it: either the resource was handed over before the thread made it to the
+ *  list of waiting threads, or the thread deschedules itself on that list.
+ *
  *  @param sem A pointer to the semaphore
  *
  *  @return void
@@ -90,35 +98,56 @@ void sem_wait(sem_t *sem) {
   // Assert that the semaphore is initialized
   assert(sem->init == SEM_INITIALIZED);
 
-  // Take the lock to ensure atomicity
-  mutex_lock(&sem->lock);
-
   // Decrement the number of available resources
-  sem->available_resources--;
+  if (atomic_add_and_update((int *)&sem->available_resources, -1) > 0) {
+    // We got a resource
+    return;
+  }
+
+  // All the available resources are being used as of now. Describe
+  // ourselves on our own stack
+  waiter_t waiter;
+  waiter.kernel_tid = thr_get_my_kernel_id();
+  waiter.wakeup = 0;
+  waiter.next = NULL;
 
-  if (sem->available_resources < 0) {
-    // All the available resources are being used as of now and there is
-    // at least one thread waiting to get the resource
-    do {
+  spinlock_lock(&sem->waiters_lock);
 
-      // Wait for the condition variable to be signaled. Wait for a thread
-      // to give up resources
-      cond_wait(&sem->cvar, &sem->lock);
+  if (sem->handoffs > 0) {
+    // A sem_signal already handed a resource over to us
+    sem->handoffs--;
+    spinlock_unlock(&sem->waiters_lock);
+    return;
+  }
+
+  // Add this thread at the end of the list of waiting threads
+  if (sem->tail == NULL) {
+    sem->head = &waiter;
+  } else {
+    sem->tail->next = &waiter;
+  }
+  sem->tail = &waiter;
 
-    } while (sem->wokenup_waiting < 1);
+  spinlock_unlock(&sem->waiters_lock);
 
-    // As one of the woken up threads now gets to run, decrement the number of
-    // threads woken up but not yet executed
-    sem->wokenup_waiting--;
+  // Tell the scheduler to not run this thread until a resource is handed
+  // over to us
+  while (!waiter.wakeup) {
+    deschedule((int *)&waiter.wakeup);
   }
 
-  // Release the lock as we are done
-  mutex_unlock(&sem->lock);
+  // Wait for the signaling thread to be done with its make_runnable() call
+  spinlock_lock(&sem->waiters_lock);
+  spinlock_unlock(&sem->waiters_lock);
 }
 
 /** @brief This function wakes up a thread waiting on the semaphore pointed 
  *   to by sem, if one exists, and updates the semaphore value regardless.
  *
+ *  If the value was negative, the resource is handed over to the first
+ *  waiting thread, or to the next thread to make it to the list of waiting
+ *  threads if there is none on it yet.
+ *
  *  @param sem A pointer to the semaphore
  *
  *  @return void
@@ -133,24 +162,32 @@ void sem_signal(sem_t *sem) {
   // Assert that the semaphore is initialized
   assert(sem->init == SEM_INITIALIZED);
 
-  // Take the lock to ensure atomicity
-  mutex_lock(&sem->lock);
-
   // Increment the number of resources available
-  sem->available_resources++;
-
-  if (sem->available_resources <= 0) {
-    // There is at least one thread waiting for a resource
-    // Increment the number of threads woken up till now
-    sem->wokenup_waiting++;
+  if (atomic_add_and_update((int *)&sem->available_resources, 1) >= 0) {
+    // No thread is waiting for a resource
+    return;
+  }
 
-    // Signal the condition variable so that any thread waiting on this
-    // condition variable gets to run
-    cond_signal(&sem->cvar);
+  // There is at least one thread waiting for a resource
+  spinlock_lock(&sem->waiters_lock);
+
+  waiter_t *waiter = sem->head;
+  if (waiter == NULL) {
+    // The thread is not on the list yet, it will find the resource
+    sem->handoffs++;
+  } else {
+    sem->head = waiter->next;
+    if (sem->head == NULL) {
+      sem->tail = NULL;
+    }
+
+    // The waiter's record may disappear as soon as its flag is set
+    int tid = waiter->kernel_tid;
+    waiter->wakeup = 1;
+    make_runnable(tid);
   }
 
-  // Release the lock as we are done
-  mutex_unlock(&sem->lock);
+  spinlock_unlock(&sem->waiters_lock);
 }
 
 /** @brief Destroys a semaphore
@@ -176,18 +213,14 @@ void sem_destroy(sem_t *sem) {
   // Assert that the semaphore is initialized
   assert(sem->init == SEM_INITIALIZED);
 
-  // Take the lock to ensure atomicity
-  mutex_lock(&sem->lock);
+  // Wait for a signaling thread to be done with the semaphore
+  spinlock_lock(&sem->waiters_lock);
+
+  // Illegal operation. Threads are waiting on the semaphore
+  assert(sem->available_resources >= 0 && sem->head == NULL);
 
   // Set the semaphore state to uninitialized
   sem->init = SEM_UNINITIALIZED;
 
-  // Destroy the condition variable
-  cond_destroy(&sem->cvar);
-
-  // Release the lock as we are done
-  mutex_unlock(&sem->lock);
-
-  // Destroy the mutex
-  mutex_destroy(&sem->lock);
+  spinlock_unlock(&sem->waiters_lock);
 }
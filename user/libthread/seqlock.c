@@ -0,0 +1,162 @@
+/** @file seqlock.c
+ *
+ *  @brief This file contains the definitions for the sequence lock functions
+ *
+ *  Writers take the lock's mutex and increment its sequence number before
+ *  and after modifying the record, like the TCB directory does for its
+ *  slots. Readers do not write anything: they read the sequence number,
+ *  copy the record, and start over if the sequence number was odd or has
+ *  changed since, which means that they raced with a writer. Readers hence
+ *  never contend with each other, but they may see a torn record, which they
+ *  must only copy and not follow pointers in before seqlock_read_retry()
+ *  returned FALSE.
+ *
+ *  The sequence number is incremented with a locked instruction, which
+ *  orders it with the writer's accesses to the record. x86 does not reorder
+ *  loads with other loads, so readers only need the compiler not to move
+ *  their reads of the record across the calls to these functions, which
+ *  live in their own translation unit for that reason.
+ *
+ *  A typical reader looks like:
+ *
+ *    do {
+ *      sequence = seqlock_read_begin(&seqlock);
+ *      copy = record;
+ *    } while (seqlock_read_retry(&seqlock, sequence));
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <seqlock.h>
+#include <mutex.h>
+#include <syscall.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <mutex_asm.h>
+
+/** @brief A macro for considering 1 as true
+ */
+#define TRUE 1
+
+/** @brief A macro for considering 0 as false
+ */
+#define FALSE 0
+
+/** @brief Initializes a sequence lock
+ *
+ *  @param seqlock The sequence lock to initialize
+ *
+ *  @return 0 on success, a negative number on error
+ */
+int seqlock_init(seqlock_t *seqlock) {
+
+  // Check validity of arguments
+  if (seqlock == NULL) {
+    return -1;
+  }
+
+  seqlock->sequence = 0;
+
+  return mutex_init(&seqlock->write_lock);
+}
+
+/** @brief Destroys a sequence lock
+ *
+ *  It is illegal to destroy a sequence lock while a writer holds it.
+ *
+ *  @param seqlock The sequence lock to destroy
+ *
+ *  @return void
+ */
+void seqlock_destroy(seqlock_t *seqlock) {
+
+  // Invalid parameter
+  assert(seqlock);
+
+  // Illegal operation. Destroying a sequence lock held by a writer
+  assert((seqlock->sequence & 1) == 0);
+
+  mutex_destroy(&seqlock->write_lock);
+}
+
+/** @brief Takes a sequence lock to modify the record it protects
+ *
+ *  Writers exclude each other. Readers which are reading the record at the
+ *  same time will retry.
+ *
+ *  @param seqlock The sequence lock
+ *
+ *  @return void
+ */
+void seqlock_write_lock(seqlock_t *seqlock) {
+
+  // Invalid parameter
+  assert(seqlock);
+
+  mutex_lock(&seqlock->write_lock);
+
+  // Make the sequence number odd before touching the record
+  atomic_add_and_update((int *)&seqlock->sequence, 1);
+}
+
+/** @brief Releases a sequence lock taken with seqlock_write_lock()
+ *
+ *  @param seqlock The sequence lock
+ *
+ *  @return void
+ */
+void seqlock_write_unlock(seqlock_t *seqlock) {
+
+  // Invalid parameter
+  assert(seqlock);
+
+  // Illegal operation. The lock is not held by a writer
+  assert(seqlock->sequence & 1);
+
+  // Make the sequence number even once we are done with the record
+  atomic_add_and_update((int *)&seqlock->sequence, 1);
+
+  mutex_unlock(&seqlock->write_lock);
+}
+
+/** @brief Starts reading the record protected by a sequence lock
+ *
+ *  If a writer is modifying the record, the calling thread yields until it
+ *  is done, since the writer may well be waiting for the CPU.
+ *
+ *  @param seqlock The sequence lock
+ *
+ *  @return The sequence number to give to seqlock_read_retry()
+ */
+unsigned int seqlock_read_begin(seqlock_t *seqlock) {
+
+  // Invalid parameter
+  assert(seqlock);
+
+  unsigned int sequence;
+  while ((sequence = seqlock->sequence) & 1) {
+    yield(-1);
+  }
+
+  return sequence;
+}
+
+/** @brief Checks whether the record protected by a sequence lock was
+ *   modified while the calling thread was reading it
+ *
+ *  @param seqlock  The sequence lock
+ *  @param sequence The value returned by seqlock_read_begin()
+ *
+ *  @return TRUE if the calling thread must read the record again, FALSE if
+ *   what it read is consistent
+ */
+int seqlock_read_retry(seqlock_t *seqlock, unsigned int sequence) {
+
+  // Invalid parameter
+  assert(seqlock);
+
+  if (seqlock->sequence != sequence) {
+    return TRUE;
+  }
+  return FALSE;
+}
@@ -0,0 +1,305 @@
+/** @file slab.c
+ *
+ *  @brief This file contains the definitions for the slab cache functions
+ *   used to allocate the thread library's fixed-size objects (TCBs, list and
+ *   queue nodes)
+ *
+ *  Objects are carved out of slabs allocated from the heap, and are never
+ *  given back to it: a freed object goes back to the cache, so that
+ *  allocating it again is cheap and objects of the same kind stay close to
+ *  each other in memory. Each thread keeps a small magazine of free objects
+ *  per cache in its TCB, so that the common allocation and free do not take
+ *  the cache's mutex. Magazines are refilled from (and flushed to) the cache's
+ *  depot in batches.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <slab.h>
+#include <stdlib.h>
+#include <mutex.h>
+#include <mutex_asm.h>
+#include <thr_internals.h>
+
+/** @brief Minimum size of a slab
+ */
+#define SLAB_SIZE PAGE_SIZE
+
+/** @brief Minimum number of objects in a slab
+ */
+#define SLAB_MIN_OBJECTS 4
+
+/** @brief Alignment of the objects
+ */
+#define SLAB_ALIGN 8
+
+/** @brief Maximum number of objects in a magazine. When it is exceeded, half
+ *   of the magazine is given back to the depot
+ */
+#define SLAB_MAGAZINE_SIZE 16
+
+/** @brief Number of objects taken from the depot when a magazine is empty
+ */
+#define SLAB_REFILL_BATCH (SLAB_MAGAZINE_SIZE / 2)
+
+/** @brief The caches with magazines, indexed by their id
+ */
+static slab_cache_t *caches[SLAB_MAX_CACHES];
+
+/** @brief Number of ids given to caches so far
+ */
+static int nb_caches = 0;
+
+/** @brief Push an object on a list of free objects
+ *
+ *  @param list   The list
+ *  @param object The object
+ *
+ *  @return void
+ */
+static void push_object(void **list, void *object) {
+  *(void **)object = *list;
+  *list = object;
+}
+
+/** @brief Pop an object from a list of free objects
+ *
+ *  @param list The list, which must not be empty
+ *
+ *  @return The object
+ */
+static void *pop_object(void **list) {
+  void *object = *list;
+  *list = *(void **)object;
+  return object;
+}
+
+/** @brief Allocate a new slab and put all of its objects in the depot
+ *
+ *  The caller must hold the cache's mutex.
+ *
+ *  @param cache The cache
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+static int grow(slab_cache_t *cache) {
+
+  char *slab = malloc(cache->objects_per_slab * cache->object_size);
+  if (slab == NULL) {
+    return -1;
+  }
+
+  // Push the objects in reverse order so that they are handed out in order
+  int i;
+  for (i = cache->objects_per_slab - 1; i >= 0; --i) {
+    push_object(&cache->free_objects, slab + i * cache->object_size);
+  }
+
+  return 0;
+}
+
+/** @brief Move objects from the depot to a magazine, holding the cache's
+ *   mutex only once
+ *
+ *  @param cache    The cache
+ *  @param magazine The magazine
+ *  @param nb       The number of objects to move
+ *
+ *  @return void
+ */
+static void refill(slab_cache_t *cache, slab_magazine_t *magazine, int nb) {
+
+  mutex_lock(&cache->mp);
+
+  if (cache->free_objects != NULL || grow(cache) == 0) {
+    while (nb > 0 && cache->free_objects != NULL) {
+      push_object(&magazine->objects, pop_object(&cache->free_objects));
+      ++magazine->nb_objects;
+      --nb;
+    }
+  }
+
+  mutex_unlock(&cache->mp);
+}
+
+/** @brief Move objects from a magazine to the depot, holding the cache's
+ *   mutex only once
+ *
+ *  @param cache    The cache
+ *  @param magazine The magazine
+ *  @param nb_keep  The number of objects to keep in the magazine
+ *
+ *  @return void
+ */
+static void flush(slab_cache_t *cache, slab_magazine_t *magazine,
+                  int nb_keep) {
+
+  mutex_lock(&cache->mp);
+
+  while (magazine->nb_objects > nb_keep) {
+    push_object(&cache->free_objects, pop_object(&magazine->objects));
+    --magazine->nb_objects;
+  }
+
+  mutex_unlock(&cache->mp);
+}
+
+/** @brief Get the calling thread's magazine for a cache
+ *
+ *  @param cache The cache
+ *
+ *  @return The magazine, NULL if the cache has no magazines or if thr_init()
+ *   was not called yet
+ */
+static slab_magazine_t *get_magazine(slab_cache_t *cache) {
+
+  if (cache->id < 0) {
+    return NULL;
+  }
+
+  tcb_t *tcb = get_tcb();
+  if (tcb == NULL) {
+    return NULL;
+  }
+
+  return &tcb->magazines[cache->id];
+}
+
+/** @brief Initialize a slab cache
+ *
+ *  Caches live for as long as the task does: there is no way to destroy
+ *  them, since free objects may be in any thread's magazine.
+ *
+ *  @param cache       The cache to initialize
+ *  @param object_size The size of the objects in the cache
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int slab_cache_init(slab_cache_t *cache, size_t object_size) {
+
+  // Check validity of arguments
+  if (cache == NULL || object_size == 0) {
+    return -1;
+  }
+
+  // Free objects must be able to hold a link
+  if (object_size < sizeof(void *)) {
+    object_size = sizeof(void *);
+  }
+  cache->object_size = (object_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+
+  cache->objects_per_slab = SLAB_SIZE / cache->object_size;
+  if (cache->objects_per_slab < SLAB_MIN_OBJECTS) {
+    cache->objects_per_slab = SLAB_MIN_OBJECTS;
+  }
+
+  cache->free_objects = NULL;
+
+  if (mutex_init(&cache->mp) < 0) {
+    return -1;
+  }
+
+  // Give the cache a magazine in every TCB if there is one left
+  cache->id = atomic_add_and_update(&nb_caches, 1);
+  if (cache->id < SLAB_MAX_CACHES) {
+    caches[cache->id] = cache;
+  } else {
+    cache->id = -1;
+  }
+
+  return 0;
+}
+
+/** @brief Allocate an object from a slab cache
+ *
+ *  @param cache The cache
+ *
+ *  @return The object, NULL if there is not enough memory
+ */
+void *slab_alloc(slab_cache_t *cache) {
+
+  slab_magazine_t *magazine = get_magazine(cache);
+
+  if (magazine == NULL) {
+    // Take a single object from the depot
+    slab_magazine_t local = { NULL, 0 };
+    refill(cache, &local, 1);
+    return local.objects;
+  }
+
+  if (magazine->objects == NULL) {
+    // Our magazine is empty, get a few objects from the depot
+    refill(cache, magazine, SLAB_REFILL_BATCH);
+    if (magazine->objects == NULL) {
+      return NULL;
+    }
+  }
+
+  --magazine->nb_objects;
+  return pop_object(&magazine->objects);
+}
+
+/** @brief Give an object back to its slab cache
+ *
+ *  @param cache  The cache the object was allocated from
+ *  @param object The object
+ *
+ *  @return void
+ */
+void slab_free(slab_cache_t *cache, void *object) {
+
+  if (object == NULL) {
+    return;
+  }
+
+  slab_magazine_t *magazine = get_magazine(cache);
+
+  if (magazine == NULL) {
+    // Put the object directly in the depot
+    slab_magazine_t local = { object, 1 };
+    *(void **)object = NULL;
+    flush(cache, &local, 0);
+    return;
+  }
+
+  push_object(&magazine->objects, object);
+
+  if (++magazine->nb_objects > SLAB_MAGAZINE_SIZE) {
+    // Our magazine is too large, give half of it back to the depot
+    flush(cache, magazine, SLAB_MAGAZINE_SIZE / 2);
+  }
+}
+
+/** @brief Initialize a thread's magazines
+ *
+ *  @param magazines The thread's SLAB_MAX_CACHES magazines
+ *
+ *  @return void
+ */
+void slab_magazines_init(slab_magazine_t *magazines) {
+
+  int i;
+  for (i = 0; i < SLAB_MAX_CACHES; ++i) {
+    magazines[i].objects = NULL;
+    magazines[i].nb_objects = 0;
+  }
+}
+
+/** @brief Give every object of a thread's magazines back to the depots
+ *
+ *  This must be called by a thread before it exits.
+ *
+ *  @param magazines The thread's SLAB_MAX_CACHES magazines
+ *
+ *  @return void
+ */
+void slab_magazines_flush(slab_magazine_t *magazines) {
+
+  int i;
+  for (i = 0; i < SLAB_MAX_CACHES; ++i) {
+    // A magazine can only hold objects if its cache was registered
+    if (magazines[i].nb_objects > 0) {
+      flush(caches[i], &magazines[i], 0);
+    }
+  }
+}
@@ -0,0 +1,81 @@
+/** @file spinlock.c
+ *
+ *  @brief This file contains the definitions for the spinlock functions
+ *   used internally by the thread library
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <spinlock.h>
+#include <atomic_ops.h>
+#include <mutex_asm.h>
+#include <syscall.h>
+#include <stdlib.h>
+
+/** @brief State of a spinlock which is not held by any thread
+ */
+#define SPINLOCK_UNLOCKED 0
+
+/** @brief State of a spinlock which is held by a thread
+ */
+#define SPINLOCK_LOCKED 1
+
+/** @brief Number of times we spin on the lock before yielding the CPU to
+ *   some other thread (the lock holder may not be running)
+ */
+#define SPINLOCK_SPIN_LIMIT 16
+
+/** @brief Initialize a spinlock
+ *
+ *  @param lock The spinlock to initialize
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int spinlock_init(spinlock_t *lock) {
+
+  if (lock == NULL) {
+    // Invalid parameter
+    return -1;
+  }
+
+  lock->locked = SPINLOCK_UNLOCKED;
+
+  return 0;
+}
+
+/** @brief Acquire a spinlock
+ *
+ *  The critical sections protected by spinlocks are only a few instructions
+ *  long, so we busy wait for a short while before yielding to let the holder
+ *  run in case it was preempted.
+ *
+ *  @param lock The spinlock to acquire
+ *
+ *  @return void
+ */
+void spinlock_lock(spinlock_t *lock) {
+
+  int spins = 0;
+
+  while (atomic_exchange(&lock->locked, SPINLOCK_LOCKED) == SPINLOCK_LOCKED) {
+    if (++spins < SPINLOCK_SPIN_LIMIT) {
+      cpu_relax();
+    } else {
+      // The holder is probably not running, let it make progress
+      yield(-1);
+    }
+  }
+}
+
+/** @brief Release a spinlock
+ *
+ *  The lock is released with an atomic exchange, which also acts as a full
+ *  memory barrier for the callers.
+ *
+ *  @param lock The spinlock to release
+ *
+ *  @return void
+ */
+void spinlock_unlock(spinlock_t *lock) {
+  atomic_exchange(&lock->locked, SPINLOCK_UNLOCKED);
+}
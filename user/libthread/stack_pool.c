@@ -0,0 +1,700 @@
+/** @file stack_pool.c
+ *
+ *  @brief This file contains the definitions for the functions managing the
+ *   pool of thread stacks
+ *
+ *  New stacks are carved in the stack region and mapped in batches, with a
+ *  single new_pages() call for the whole batch. Since a region given to
+ *  new_pages() is contiguous, the guard pages between the stacks of a batch
+ *  are mapped as well: only the guard page below the last stack of a batch
+ *  still catches overflows. A high watermark of 0 maps the stacks one at a
+ *  time, which keeps every guard page.
+ *
+ *  Stacks of threads which were joined go back to the pool, so a thread
+ *  creation usually does not make any system call. A stack is only put back
+ *  once its thread has vanished (see thr_reap()), so a free stack is never
+ *  used by anybody. When the pool holds more free stacks than its trim
+ *  limit, batches whose stacks are all free are unmapped with remove_pages()
+ *  (which can only unmap a whole batch). The address ranges they leave are
+ *  merged with the neighbouring unmapped ranges, are given back to the
+ *  unused part of the stack region when they reach task.stack_lowest, and
+ *  are reused by later batches. Other memory may be mapped in such a hole in
+ *  the meantime (by the application or by malloc()), so a range of a hole
+ *  where new_pages() fails is retired for good, and the batch is mapped
+ *  somewhere else.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <stack_pool.h>
+#include <global_state.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <syscall.h>
+#include <mutex.h>
+
+/** @brief Get the distance between the highest addresses of two consecutive
+ *   stacks (stack, exception stack and guard page)
+ *
+ *  @return The distance in bytes
+ */
+static unsigned int stack_stride(void) {
+  return task.stack_size + 2 * PAGE_SIZE;
+}
+
+/** @brief Get the word of a free stack holding the next free stack
+ *
+ *  @param stack_high The highest address of the stack
+ *
+ *  @return A pointer to the lowest word of the stack's exception stack
+ */
+static unsigned int **next_free(unsigned int *stack_high) {
+  return (unsigned int **)((unsigned int)stack_high - PAGE_SIZE);
+}
+
+/** @brief Remove a batch from the list of batches with free stacks
+ *
+ *  The caller must hold the pool's mutex.
+ *
+ *  @param pool  The stack pool
+ *  @param batch The batch
+ *
+ *  @return void
+ */
+static void unlink_batch(stack_pool_t *pool, stack_region_t *batch) {
+
+  if (batch->prev != NULL) {
+    batch->prev->next = batch->next;
+  } else {
+    pool->head = batch->next;
+  }
+
+  if (batch->next != NULL) {
+    batch->next->prev = batch->prev;
+  } else {
+    pool->tail = batch->prev;
+  }
+}
+
+/** @brief Put a batch at the head of the list of batches with free stacks
+ *
+ *  The caller must hold the pool's mutex.
+ *
+ *  @param pool  The stack pool
+ *  @param batch The batch, which must not be in the list
+ *
+ *  @return void
+ */
+static void link_batch(stack_pool_t *pool, stack_region_t *batch) {
+
+  batch->prev = NULL;
+  batch->next = pool->head;
+
+  if (pool->head != NULL) {
+    pool->head->prev = batch;
+  } else {
+    pool->tail = batch;
+  }
+  pool->head = batch;
+}
+
+/** @brief Turn a range of the stack region into a hole, merging it with the
+ *   neighbouring holes
+ *
+ *  The lowest hole is given back to the unused part of the stack region when
+ *  it reaches task.stack_lowest. The caller must hold the pool's mutex.
+ *
+ *  @param pool   The stack pool
+ *  @param region The range, whose descriptor is either kept in the list of
+ *   holes or freed
+ *
+ *  @return void
+ */
+static void add_hole(stack_pool_t *pool, stack_region_t *region) {
+
+  stack_region_t *prev = NULL, *next = pool->holes;
+
+  // Find the holes surrounding the range
+  while (next != NULL && next->top <= region->base) {
+    prev = next;
+    next = next->next;
+  }
+
+  if (next != NULL && next->base == region->top) {
+    // Merge with the hole above
+    next->base = region->base;
+    free(region);
+    region = next;
+  } else {
+    region->next = next;
+    if (prev != NULL) {
+      prev->next = region;
+    } else {
+      pool->holes = region;
+    }
+  }
+
+  if (prev != NULL && prev->top == region->base) {
+    // Merge with the hole below
+    prev->top = region->top;
+    prev->next = region->next;
+    free(region);
+  }
+
+  // The lowest hole may reach the end of the stack region
+  region = pool->holes;
+  if ((unsigned int)task.stack_lowest == region->base) {
+    task.stack_lowest = (unsigned int *)region->top;
+    pool->holes = region->next;
+    free(region);
+  }
+}
+
+/** @brief Reserve an address range for a batch, in the highest hole large
+ *   enough for it, or below the lowest stack of the task
+ *
+ *  The caller must hold the pool's mutex.
+ *
+ *  @param pool  The stack pool
+ *  @param batch The batch, whose base and top are set
+ *  @param size  The size of the range
+ *
+ *  @return 1 if the range was taken from a hole, 0 if it was taken below the
+ *   lowest stack, a negative error code if the address space below the
+ *   lowest stack is too small
+ */
+static int reserve_range(stack_pool_t *pool, stack_region_t *batch,
+                         unsigned int size) {
+
+  stack_region_t *hole, *prev = NULL, *fit = NULL, *fit_prev = NULL;
+
+  for (hole = pool->holes; hole != NULL; hole = hole->next) {
+    if (hole->top - hole->base >= size) {
+      fit = hole;
+      fit_prev = prev;
+    }
+    prev = hole;
+  }
+
+  if (fit == NULL) {
+    if (size > (unsigned int)task.stack_lowest) {
+      return -1;
+    }
+    batch->base = (unsigned int)task.stack_lowest - size;
+    batch->top = (unsigned int)task.stack_lowest;
+    task.stack_lowest = (unsigned int *)batch->base;
+    return 0;
+  }
+
+  // Take the top of the hole, so that stacks stay as high as possible
+  batch->top = fit->top;
+  batch->base = fit->top - size;
+  fit->top = batch->base;
+
+  if (fit->top == fit->base) {
+    if (fit_prev != NULL) {
+      fit_prev->next = fit->next;
+    } else {
+      pool->holes = fit->next;
+    }
+    free(fit);
+  }
+
+  return 1;
+}
+
+/** @brief Map a batch of new stacks and put them in the pool
+ *
+ *  The caller must hold the pool's mutex, which is released while the pages
+ *  are mapped.
+ *
+ *  @param pool The stack pool
+ *  @param nb   The number of stacks to map
+ *
+ *  @return 0 on success, 1 if the range of a hole could not be mapped (it is
+ *   retired, and another range may be tried), a negative error code on
+ *   failure
+ */
+static int map_stacks(stack_pool_t *pool, int nb) {
+
+  unsigned int stride = stack_stride();
+  if ((unsigned int)nb > UINT_MAX / stride) {
+    return -1;
+  }
+
+  stack_region_t *batch = malloc(sizeof(stack_region_t));
+  if (batch == NULL) {
+    return -1;
+  }
+
+  int in_hole = reserve_range(pool, batch, nb * stride);
+  if (in_hole < 0) {
+    free(batch);
+    return -1;
+  }
+
+  // Map everything but the guard page above the highest stack
+  mutex_unlock(&pool->mp);
+  int ret = new_pages((void *)batch->base, nb * stride - PAGE_SIZE);
+  mutex_lock(&pool->mp);
+
+  if (ret < 0 && in_hole) {
+    // Something else may be mapped there, never try the range again
+    free(batch);
+    return 1;
+  }
+
+  if (ret < 0) {
+    // Give the range back
+    add_hole(pool, batch);
+    return -1;
+  }
+
+  batch->nb_stacks = nb;
+  batch->nb_free = nb;
+  batch->nb_slots = 0;
+  batch->free_stacks = NULL;
+
+  // Push the lowest stack first, so that stacks are handed out from the top
+  int i;
+  for (i = nb - 1; i >= 0; --i) {
+    unsigned int *stack_high =
+        (unsigned int *)(batch->top - PAGE_SIZE - i * stride);
+    *next_free(stack_high) = batch->free_stacks;
+    batch->free_stacks = stack_high;
+  }
+
+  link_batch(pool, batch);
+  pool->nb_free += nb;
+
+  return 0;
+}
+
+/** @brief Map new stacks, trying other ranges when a hole can not be mapped
+ *   and smaller batches when a batch can not be mapped below the lowest stack
+ *
+ *  The caller must hold the pool's mutex.
+ *
+ *  @param pool The stack pool
+ *  @param nb   The number of stacks to map
+ *
+ *  @return void
+ */
+static void refill(stack_pool_t *pool, int nb) {
+
+  while (nb > 0) {
+    int ret = map_stacks(pool, nb);
+    if (ret == 0) {
+      return;
+    }
+    // A retired hole is not picked again, so retrying terminates
+    if (ret < 0) {
+      nb /= 2;
+    }
+  }
+}
+
+/** @brief Unmap a batch whose stacks are all free
+ *
+ *  The caller must hold the pool's mutex, which is released while the pages
+ *  are unmapped.
+ *
+ *  @param pool  The stack pool
+ *  @param batch The batch
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+static int unmap_stacks(stack_pool_t *pool, stack_region_t *batch) {
+
+  // Nobody can take a stack from the batch once it is out of the list
+  unlink_batch(pool, batch);
+  pool->nb_free -= batch->nb_free;
+
+  mutex_unlock(&pool->mp);
+  int ret = remove_pages((void *)batch->base);
+  mutex_lock(&pool->mp);
+
+  if (ret < 0) {
+    // Keep the batch
+    link_batch(pool, batch);
+    pool->nb_free += batch->nb_free;
+    return -1;
+  }
+
+  add_hole(pool, batch);
+
+  return 0;
+}
+
+/** @brief Unmap batches of free stacks while the pool holds more free stacks
+ *   than its trim limit, least recently used batches first
+ *
+ *  The caller must hold the pool's mutex.
+ *
+ *  @param pool  The stack pool
+ *  @param batch The batch a stack was just put back in
+ *
+ *  @return void
+ */
+static void trim(stack_pool_t *pool, stack_region_t *batch) {
+
+  // Keep enough stacks for the next refill not to map them again
+  int limit = pool->trim_limit;
+  if (limit < pool->high_watermark) {
+    limit = pool->high_watermark;
+  }
+
+  while (pool->nb_free > limit) {
+    stack_region_t *victim = pool->tail;
+
+    if (victim->nb_free != victim->nb_stacks) {
+      // The coldest batch is in use, try the one which just became free
+      if (batch == NULL || batch->nb_free != batch->nb_stacks) {
+        return;
+      }
+      victim = batch;
+    }
+
+    if (pool->nb_free - victim->nb_free < limit) {
+      return;
+    }
+
+    if (unmap_stacks(pool, victim) < 0) {
+      return;
+    }
+
+    // The mutex was released, the batch may have been unmapped by another
+    // thread in the meantime
+    batch = NULL;
+  }
+}
+
+/** @brief Initialize the stack pool
+ *
+ *  @param pool The stack pool to initialize
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int stack_pool_init(stack_pool_t *pool) {
+
+  // Check validity of argument
+  if (pool == NULL) {
+    return -1;
+  }
+
+  pool->head = NULL;
+  pool->tail = NULL;
+  pool->holes = NULL;
+  pool->nb_free = 0;
+  pool->low_watermark = STACK_POOL_LOW_WATERMARK;
+  pool->high_watermark = STACK_POOL_HIGH_WATERMARK;
+  pool->trim_limit = STACK_POOL_TRIM_LIMIT;
+
+  return mutex_init(&pool->mp);
+}
+
+/** @brief Take the most recently freed stack from the pool
+ *
+ *  The caller must hold the pool's mutex, and the pool must not be empty.
+ *
+ *  @param pool  The stack pool
+ *  @param batch Set to the batch of the stack
+ *
+ *  @return The highest address of the stack
+ */
+static unsigned int *take_stack(stack_pool_t *pool, stack_region_t **batch) {
+
+  stack_region_t *region = pool->head;
+
+  unsigned int *stack_high = region->free_stacks;
+  region->free_stacks = *next_free(stack_high);
+  --pool->nb_free;
+
+  if (--region->nb_free == 0) {
+    unlink_batch(pool, region);
+  }
+
+  *batch = region;
+  return stack_high;
+}
+
+/** @brief Take a stack from the pool, mapping new stacks if needed
+ *
+ *  @param pool  The stack pool
+ *  @param batch Set to the batch of the stack, which must be given back
+ *   with it to stack_pool_put()
+ *
+ *  @return The highest address of the stack, NULL if no stack could be
+ *   mapped
+ */
+unsigned int *stack_pool_get(stack_pool_t *pool, stack_region_t **batch) {
+
+  mutex_lock(&pool->mp);
+
+  if (pool->nb_free <= pool->low_watermark) {
+    // Taking a stack would leave the pool under its low watermark, refill
+    // it up to its high watermark (plus the stack we take)
+    int nb = pool->high_watermark - pool->nb_free + 1;
+    refill(pool, (nb < 1) ? 1 : nb);
+  }
+
+  if (pool->head == NULL) {
+    mutex_unlock(&pool->mp);
+    return NULL;
+  }
+
+  unsigned int *stack_high = take_stack(pool, batch);
+
+  mutex_unlock(&pool->mp);
+
+  return stack_high;
+}
+
+/** @brief Put a stack back in its batch
+ *
+ *  The caller must hold the pool's mutex.
+ *
+ *  @param pool       The stack pool
+ *  @param stack_high The highest address of the stack
+ *  @param batch      The batch of the stack
+ *
+ *  @return void
+ */
+static void put_stack(stack_pool_t *pool, unsigned int *stack_high,
+                      stack_region_t *batch) {
+
+  *next_free(stack_high) = batch->free_stacks;
+  batch->free_stacks = stack_high;
+  ++pool->nb_free;
+
+  // Move the batch to the head of the list
+  if (batch->nb_free++ > 0) {
+    unlink_batch(pool, batch);
+  }
+  link_batch(pool, batch);
+}
+
+/** @brief Take several stacks from the pool at once
+ *
+ *  The free stacks of the pool are taken first, then all the missing stacks
+ *  (plus the pool's high watermark) are mapped with a single system call,
+ *  even if batching is disabled: the stacks of that batch, but the lowest
+ *  one, have no guard page. Smaller batches are tried if it fails. Either
+ *  all the stacks are taken, or none of them is.
+ *
+ *  @param pool    The stack pool
+ *  @param nb      The number of stacks to take
+ *  @param stacks  Filled with the highest address of each stack
+ *  @param batches Filled with the batch of each stack, which must be given
+ *   back with it to stack_pool_put()
+ *
+ *  @return 0 on success, a negative error code if not enough stacks could
+ *   be mapped
+ */
+int stack_pool_get_n(stack_pool_t *pool, int nb, unsigned int **stacks,
+                     stack_region_t **batches) {
+
+  mutex_lock(&pool->mp);
+
+  // Number of stacks to map at once, halved when a batch can not be mapped
+  unsigned int size = INT_MAX;
+
+  int taken = 0;
+  while (taken < nb) {
+
+    if (pool->head != NULL) {
+      stacks[taken] = take_stack(pool, &batches[taken]);
+      ++taken;
+      continue;
+    }
+
+    // Map the missing stacks. Once map_stacks() succeeds the new batch is
+    // at the head of the list, and we hold the mutex until we took its
+    // stacks, so other threads can not make us miss them
+    unsigned int missing = (unsigned int)(nb - taken) + pool->high_watermark;
+    if (size > missing) {
+      size = missing;
+    }
+    if (size == 0) {
+      break;
+    }
+
+    // A retired hole is not picked again, so retrying terminates
+    if (map_stacks(pool, size) < 0) {
+      size /= 2;
+    }
+  }
+
+  if (taken < nb) {
+    // Give back the stacks we took
+    while (--taken >= 0) {
+      put_stack(pool, stacks[taken], batches[taken]);
+    }
+    trim(pool, NULL);
+    mutex_unlock(&pool->mp);
+    return -1;
+  }
+
+  mutex_unlock(&pool->mp);
+
+  return 0;
+}
+
+/** @brief Map a stack spanning several slots, for a thread needing a larger
+ *   stack than the others
+ *
+ *  The stack is mapped on its own, and is never kept in the pool: it is
+ *  unmapped as soon as it is given back with stack_pool_put().
+ *
+ *  @param pool     The stack pool
+ *  @param nb_slots The number of slots the stack spans
+ *  @param batch    Set to the batch of the stack, which must be given back
+ *   with it to stack_pool_put()
+ *
+ *  @return The highest address of the stack, NULL if it could not be mapped
+ */
+unsigned int *stack_pool_get_sized(stack_pool_t *pool, int nb_slots,
+                                   stack_region_t **batch) {
+
+  unsigned int size = nb_slots * stack_stride();
+
+  stack_region_t *region = malloc(sizeof(stack_region_t));
+  if (region == NULL) {
+    return NULL;
+  }
+
+  // Something else may be mapped in a hole, in which case the range is
+  // retired for good and another one is tried
+  int in_hole, ret;
+  do {
+    mutex_lock(&pool->mp);
+    in_hole = reserve_range(pool, region, size);
+    mutex_unlock(&pool->mp);
+
+    if (in_hole < 0) {
+      free(region);
+      return NULL;
+    }
+
+    // Map everything but the guard page above the stack
+    ret = new_pages((void *)region->base, size - PAGE_SIZE);
+  } while (ret < 0 && in_hole);
+
+  if (ret < 0) {
+    // Give the range back
+    mutex_lock(&pool->mp);
+    add_hole(pool, region);
+    mutex_unlock(&pool->mp);
+    return NULL;
+  }
+
+  region->nb_stacks = 1;
+  region->nb_free = 0;
+  region->nb_slots = nb_slots;
+  region->free_stacks = NULL;
+  region->prev = NULL;
+  region->next = NULL;
+
+  *batch = region;
+  return (unsigned int *)(region->top - PAGE_SIZE);
+}
+
+/** @brief Unmap a stack mapped by stack_pool_get_sized()
+ *
+ *  @param pool  The stack pool
+ *  @param batch The batch of the stack
+ *
+ *  @return void
+ */
+static void put_sized(stack_pool_t *pool, stack_region_t *batch) {
+
+  int ret = remove_pages((void *)batch->base);
+
+  mutex_lock(&pool->mp);
+
+  if (ret < 0) {
+    // The range is still mapped, never hand it out again
+    free(batch);
+  } else {
+    add_hole(pool, batch);
+  }
+
+  mutex_unlock(&pool->mp);
+}
+
+/** @brief Give a stack back to the pool
+ *
+ *  @param pool       The stack pool
+ *  @param stack_high The highest address of the stack
+ *  @param batch      The batch of the stack
+ *
+ *  @return void
+ */
+void stack_pool_put(stack_pool_t *pool, unsigned int *stack_high,
+                    stack_region_t *batch) {
+
+  if (batch->nb_slots > 0) {
+    put_sized(pool, batch);
+    return;
+  }
+
+  mutex_lock(&pool->mp);
+
+  put_stack(pool, stack_high, batch);
+  trim(pool, batch);
+
+  mutex_unlock(&pool->mp);
+}
+
+/** @brief Tune the number of free stacks kept ready by the thread library
+ *
+ *  When a thread creation would leave fewer than low_watermark free stacks,
+ *  new stacks are mapped (with a single system call) so that high_watermark
+ *  free stacks are left. Both are 0 by default. A high watermark above 0
+ *  trades the guard pages of the stacks of a batch (but the lowest one) for
+ *  fewer system calls. This function must be called after thr_init().
+ *
+ *  @param low_watermark  The low watermark
+ *  @param high_watermark The high watermark
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int thr_stack_watermarks(int low_watermark, int high_watermark) {
+
+  // Check validity of arguments
+  if (low_watermark < 0 || high_watermark < low_watermark) {
+    return -1;
+  }
+
+  mutex_lock(&task.stacks.mp);
+  task.stacks.low_watermark = low_watermark;
+  task.stacks.high_watermark = high_watermark;
+  mutex_unlock(&task.stacks.mp);
+
+  return 0;
+}
+
+/** @brief Tune the number of free stacks kept mapped by the thread library
+ *
+ *  When more stacks than trim_limit (and than the high watermark) are free,
+ *  the memory of the least recently used batches of free stacks is given
+ *  back to the kernel. This function must be called after thr_init().
+ *
+ *  @param trim_limit The trim limit
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int thr_stack_trim_limit(int trim_limit) {
+
+  // Check validity of argument
+  if (trim_limit < 0) {
+    return -1;
+  }
+
+  mutex_lock(&task.stacks.mp);
+  task.stacks.trim_limit = trim_limit;
+  trim(&task.stacks, NULL);
+  mutex_unlock(&task.stacks.mp);
+
+  return 0;
+}
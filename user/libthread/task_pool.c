@@ -0,0 +1,710 @@
+/** @file task_pool.c
+ *
+ *  @brief This file contains the definitions for the work-stealing task pool
+ *   functions
+ *
+ *  A task pool runs tasks on a fixed set of worker threads, so that running a
+ *  task costs a deque push instead of a thr_create()/thr_join() cycle. Each
+ *  worker owns a Chase-Lev deque: tasks spawned by a worker are pushed at the
+ *  bottom of its own deque, and the worker pops them back from there, newest
+ *  first. A worker whose deque is empty steals the oldest task of another
+ *  worker's deque, or takes a task submitted by a thread outside of the pool.
+ *  Workers which find nothing to do deschedule themselves until a task is
+ *  pushed.
+ *
+ *  A worker waiting on a task keeps running other tasks until it is done, so
+ *  recursive parallelism (a task spawning tasks and syncing on them) never
+ *  blocks a worker. Other threads deschedule themselves until the task is
+ *  done.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <task_pool.h>
+#include <thread.h>
+#include <syscall.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <atomic_ops.h>
+#include <mutex_asm.h>
+#include <thr_internals.h>
+
+/** @brief State of a task which was not run yet, and that no thread waits on
+ */
+#define TASK_PENDING 0
+
+/** @brief State of a task which was not run yet, and that a thread which is
+ *   not a worker waits on
+ */
+#define TASK_WAITING 1
+
+/** @brief State of a task which was run
+ */
+#define TASK_DONE 2
+
+/** @brief State of a task which nobody waits on, and which is not touched by
+ *   the pool once its function was called
+ */
+#define TASK_DETACHED 3
+
+/** @brief Mask giving the index of a task in a deque
+ */
+#define DEQUE_MASK (TASK_POOL_DEQUE_SIZE - 1)
+
+/** @brief Push a task at the bottom of a worker's deque. Only the worker
+ *   owning the deque may call this
+ *
+ *  @param worker The worker
+ *  @param ptask  The task
+ *
+ *  @return 0 on success, -1 if the deque is full
+ */
+static int deque_push(task_pool_worker_t *worker, pool_task_t *ptask) {
+
+  int bottom = worker->bottom;
+  if (bottom - worker->top >= TASK_POOL_DEQUE_SIZE) {
+    return -1;
+  }
+
+  // The task must be in the deque before thieves can see it
+  worker->tasks[bottom & DEQUE_MASK] = ptask;
+  worker->bottom = bottom + 1;
+
+  return 0;
+}
+
+/** @brief Pop the newest task from the bottom of a worker's deque. Only the
+ *   worker owning the deque may call this
+ *
+ *  @param worker The worker
+ *
+ *  @return The task, NULL if the deque is empty
+ */
+static pool_task_t *deque_pop(task_pool_worker_t *worker) {
+
+  // Claim the bottom task. The exchange makes sure that thieves see our claim
+  // before we read the top of the deque
+  int bottom = worker->bottom - 1;
+  atomic_exchange((int *)&worker->bottom, bottom);
+
+  int top = worker->top;
+  if (top > bottom) {
+    // The deque was empty
+    worker->bottom = bottom + 1;
+    return NULL;
+  }
+
+  pool_task_t *ptask = worker->tasks[bottom & DEQUE_MASK];
+
+  if (top == bottom) {
+    // This is the last task, thieves may be trying to take it too
+    if (atomic_compare_and_swap((int *)&worker->top, top, top + 1) != top) {
+      ptask = NULL;
+    }
+    worker->bottom = bottom + 1;
+  }
+
+  return ptask;
+}
+
+/** @brief Steal the oldest task from the top of a worker's deque
+ *
+ *  @param worker The worker to steal from
+ *
+ *  @return The task, NULL if the deque is empty or if another thread took
+ *   the task first
+ */
+static pool_task_t *deque_steal(task_pool_worker_t *worker) {
+
+  int top = worker->top;
+  int bottom = worker->bottom;
+  if (top >= bottom) {
+    return NULL;
+  }
+
+  // Read the task before claiming it, its slot may be reused right after
+  pool_task_t *ptask = worker->tasks[top & DEQUE_MASK];
+  if (atomic_compare_and_swap((int *)&worker->top, top, top + 1) != top) {
+    return NULL;
+  }
+
+  return ptask;
+}
+
+/** @brief Get a pseudo-random number to pick a worker to steal from
+ *
+ *  @param worker The worker looking for a victim
+ *
+ *  @return The number
+ */
+static unsigned int next_random(task_pool_worker_t *worker) {
+
+  unsigned int x = worker->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  worker->seed = x;
+
+  return x;
+}
+
+/** @brief Take the oldest task submitted by a thread outside of the pool
+ *
+ *  @param pool The pool
+ *
+ *  @return The task, NULL if there is none
+ */
+static pool_task_t *take_submitted(task_pool_t *pool) {
+
+  // Don't bother taking the lock when there is obviously nothing to take
+  if (pool->submitted_head == NULL) {
+    return NULL;
+  }
+
+  spinlock_lock(&pool->submitted_lock);
+
+  pool_task_t *ptask = pool->submitted_head;
+  if (ptask != NULL) {
+    pool->submitted_head = ptask->next;
+    if (pool->submitted_head == NULL) {
+      pool->submitted_tail = NULL;
+    }
+  }
+
+  spinlock_unlock(&pool->submitted_lock);
+
+  return ptask;
+}
+
+/** @brief Find a task for a worker to run: from its own deque first, then
+ *   from the other workers' deques, then from the submitted tasks
+ *
+ *  @param worker The worker
+ *
+ *  @return The task, NULL if none was found
+ */
+static pool_task_t *find_task(task_pool_worker_t *worker) {
+
+  pool_task_t *ptask = deque_pop(worker);
+  if (ptask != NULL) {
+    return ptask;
+  }
+
+  // Try every other worker once, starting from a random one
+  task_pool_t *pool = worker->pool;
+  int start = next_random(worker) % pool->nb_workers;
+  int i;
+  for (i = 0; i < pool->nb_workers; ++i) {
+    task_pool_worker_t *victim;
+    victim = &pool->workers[(start + i) % pool->nb_workers];
+    if (victim != worker) {
+      ptask = deque_steal(victim);
+      if (ptask != NULL) {
+        return ptask;
+      }
+    }
+  }
+
+  return take_submitted(pool);
+}
+
+/** @brief Check whether any task is waiting to be run in a pool
+ *
+ *  @param pool The pool
+ *
+ *  @return Non-zero if there is a task to run, 0 otherwise
+ */
+static int has_work(task_pool_t *pool) {
+
+  if (pool->submitted_head != NULL) {
+    return 1;
+  }
+
+  int i;
+  for (i = 0; i < pool->nb_workers; ++i) {
+    if (pool->workers[i].top < pool->workers[i].bottom) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/** @brief Wake up one idle worker of a pool, if there is one
+ *
+ *  @param pool The pool
+ *
+ *  @return void
+ */
+static void wake_worker(task_pool_t *pool) {
+
+  spinlock_lock(&pool->parked_lock);
+
+  waiter_t *waiter = pool->parked;
+  if (waiter != NULL) {
+    pool->parked = waiter->next;
+    --pool->nb_parked;
+
+    // The waiter's record may disappear as soon as its flag is set
+    int tid = waiter->kernel_tid;
+    waiter->wakeup = 1;
+    make_runnable(tid);
+  }
+
+  spinlock_unlock(&pool->parked_lock);
+}
+
+/** @brief Wake up an idle worker after a task was pushed, if any worker is
+ *   idle
+ *
+ *  The locked read pairs with the one in park(): either the idle worker sees
+ *  the new task before descheduling itself, or we see the idle worker.
+ *
+ *  @param pool The pool
+ *
+ *  @return void
+ */
+static void notify(task_pool_t *pool) {
+
+  if (atomic_add_and_update(&pool->nb_parked, 0) > 0) {
+    wake_worker(pool);
+  }
+}
+
+/** @brief Deschedule an idle worker until a task is pushed or the pool is
+ *   destroyed
+ *
+ *  @param worker The worker
+ *
+ *  @return void
+ */
+static void park(task_pool_worker_t *worker) {
+
+  task_pool_t *pool = worker->pool;
+
+  // Describe ourselves on our own stack
+  waiter_t waiter;
+  waiter.kernel_tid = thr_get_my_kernel_id();
+  waiter.wakeup = 0;
+
+  spinlock_lock(&pool->parked_lock);
+  waiter.next = pool->parked;
+  pool->parked = &waiter;
+  atomic_add_and_update(&pool->nb_parked, 1);
+
+  // Look again now that threads pushing tasks can see us
+  if (pool->shutdown || has_work(pool)) {
+    pool->parked = waiter.next;
+    --pool->nb_parked;
+    spinlock_unlock(&pool->parked_lock);
+    return;
+  }
+
+  spinlock_unlock(&pool->parked_lock);
+
+  // Tell the scheduler to not run this thread until a task is pushed
+  while (!waiter.wakeup) {
+    deschedule((int *)&waiter.wakeup);
+  }
+
+  // Wait for the waking thread to be done with its make_runnable() call
+  spinlock_lock(&pool->parked_lock);
+  spinlock_unlock(&pool->parked_lock);
+}
+
+/** @brief Run a task and wake up the thread waiting on it, if any
+ *
+ *  @param ptask The task
+ *
+ *  @return void
+ */
+static void run_task(pool_task_t *ptask) {
+
+  if (ptask->state == TASK_DETACHED) {
+    // The task may disappear as soon as its function is called
+    ptask->func(ptask->arg);
+    return;
+  }
+
+  ptask->result = ptask->func(ptask->arg);
+
+  // The task may disappear as soon as it is marked done, unless a thread
+  // waits on it, in which case that thread waits for us to release the lock
+  if (atomic_exchange((int *)&ptask->state, TASK_DONE) == TASK_WAITING) {
+    spinlock_lock(&ptask->lock);
+    int tid = ptask->waiter->kernel_tid;
+    ptask->waiter->wakeup = 1;
+    make_runnable(tid);
+    spinlock_unlock(&ptask->lock);
+  }
+}
+
+/** @brief Initialize a task
+ *
+ *  @param ptask The task
+ *  @param func  The function run by the task
+ *  @param arg   The argument given to the function
+ *
+ *  @return void
+ */
+static void init_task(pool_task_t *ptask, void *(*func)(void *), void *arg) {
+
+  ptask->func = func;
+  ptask->arg = arg;
+  ptask->result = NULL;
+  ptask->state = TASK_PENDING;
+  ptask->waiter = NULL;
+  spinlock_init(&ptask->lock);
+  ptask->next = NULL;
+}
+
+/** @brief Get the calling thread's worker in a task pool
+ *
+ *  @param pool The pool
+ *
+ *  @return The worker, NULL if the calling thread is not one of the pool's
+ *   workers
+ */
+task_pool_worker_t *task_pool_my_worker(task_pool_t *pool) {
+
+  task_pool_worker_t *worker = get_tcb()->pool_worker;
+
+  if (worker == NULL || worker->pool != pool) {
+    return NULL;
+  }
+  return worker;
+}
+
+/** @brief The function run by the worker threads
+ *
+ *  @param arg The worker
+ *
+ *  @return NULL
+ */
+static void *worker_main(void *arg) {
+
+  task_pool_worker_t *worker = arg;
+  task_pool_t *pool = worker->pool;
+
+  get_tcb()->pool_worker = worker;
+
+  while (!pool->shutdown) {
+    pool_task_t *ptask = find_task(worker);
+    if (ptask != NULL) {
+      run_task(ptask);
+    } else {
+      park(worker);
+    }
+  }
+
+  return NULL;
+}
+
+/** @brief Make the workers of a pool exit and wait for them
+ *
+ *  @param pool       The pool
+ *  @param nb_started The number of workers which were started
+ *
+ *  @return void
+ */
+static void stop_workers(task_pool_t *pool, int nb_started) {
+
+  pool->shutdown = 1;
+
+  // Idle workers see the flag either before parking or once woken up
+  spinlock_lock(&pool->parked_lock);
+  while (pool->parked != NULL) {
+    waiter_t *waiter = pool->parked;
+    pool->parked = waiter->next;
+    --pool->nb_parked;
+
+    int tid = waiter->kernel_tid;
+    waiter->wakeup = 1;
+    make_runnable(tid);
+  }
+  spinlock_unlock(&pool->parked_lock);
+
+  int i;
+  for (i = 0; i < nb_started; ++i) {
+    thr_join(pool->workers[i].tid, NULL);
+  }
+}
+
+/** @brief Append a task to the queue of submitted tasks of a pool
+ *
+ *  @param pool  The pool
+ *  @param ptask The task
+ *
+ *  @return void
+ */
+static void queue_submitted(task_pool_t *pool, pool_task_t *ptask) {
+
+  spinlock_lock(&pool->submitted_lock);
+  if (pool->submitted_tail == NULL) {
+    pool->submitted_head = ptask;
+  } else {
+    pool->submitted_tail->next = ptask;
+  }
+  pool->submitted_tail = ptask;
+  spinlock_unlock(&pool->submitted_lock);
+}
+
+/** @brief Push an initialized task on the calling worker's deque, or queue
+ *   it like task_pool_submit() does if the calling thread is not a worker
+ *
+ *  If the worker's deque is full, the task is run right away.
+ *
+ *  @param pool  The pool
+ *  @param ptask The task
+ *
+ *  @return void
+ */
+static void push_task(task_pool_t *pool, pool_task_t *ptask) {
+
+  task_pool_worker_t *worker = task_pool_my_worker(pool);
+
+  if (worker == NULL) {
+    queue_submitted(pool, ptask);
+  } else if (deque_push(worker, ptask) < 0) {
+    run_task(ptask);
+    return;
+  }
+
+  notify(pool);
+}
+
+/** @brief Initialize a task pool and start its workers
+ *
+ *  @param pool       The pool to initialize
+ *  @param nb_workers The number of worker threads
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int task_pool_init(task_pool_t *pool, int nb_workers) {
+
+  // Check validity of arguments
+  if (pool == NULL || nb_workers <= 0) {
+    return -1;
+  }
+
+  pool->workers = malloc(nb_workers * sizeof(task_pool_worker_t));
+  if (pool->workers == NULL) {
+    return -1;
+  }
+
+  pool->nb_workers = nb_workers;
+  pool->submitted_head = NULL;
+  pool->submitted_tail = NULL;
+  spinlock_init(&pool->submitted_lock);
+  pool->parked = NULL;
+  pool->nb_parked = 0;
+  spinlock_init(&pool->parked_lock);
+  pool->shutdown = 0;
+
+  // Every deque must be usable before the first worker runs
+  int i;
+  for (i = 0; i < nb_workers; ++i) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].seed = i + 1;
+    pool->workers[i].top = 0;
+    pool->workers[i].bottom = 0;
+  }
+
+  for (i = 0; i < nb_workers; ++i) {
+    int tid = thr_create(worker_main, &pool->workers[i]);
+    if (tid < 0) {
+      stop_workers(pool, i);
+      free(pool->workers);
+      return -1;
+    }
+    pool->workers[i].tid = tid;
+  }
+
+  return 0;
+}
+
+/** @brief Stop the workers of a task pool and free its resources
+ *
+ *  Every task run by the pool must be done before the pool is destroyed, which
+ *  is known for sure once task_pool_sync() returned for it (or once a detached
+ *  task handed its result over).
+ *
+ *  @param pool The pool to destroy
+ *
+ *  @return void
+ */
+void task_pool_destroy(task_pool_t *pool) {
+
+  // Invalid parameter
+  assert(pool);
+
+  // Illegal operation. Destroying a pool from one of its own workers
+  assert(task_pool_my_worker(pool) == NULL);
+
+  stop_workers(pool, pool->nb_workers);
+  free(pool->workers);
+}
+
+/** @brief Submit a task to a task pool. The task is queued for the first
+ *   worker which runs out of tasks in its own deque
+ *
+ *  @param pool  The pool
+ *  @param ptask The task, which must stay valid until task_pool_sync() is
+ *   called on it
+ *  @param func  The function run by the task
+ *  @param arg   The argument given to the function
+ *
+ *  @return void
+ */
+void task_pool_submit(task_pool_t *pool, pool_task_t *ptask,
+                      void *(*func)(void *), void *arg) {
+
+  // Invalid parameter
+  assert(pool && ptask && func);
+
+  init_task(ptask, func, arg);
+  queue_submitted(pool, ptask);
+
+  notify(pool);
+}
+
+/** @brief Spawn a task in a task pool
+ *
+ *  When called by one of the pool's workers, the task is pushed on the
+ *  worker's own deque, where the worker itself (or an idle worker stealing
+ *  it) will find it. If the deque is full, the task is run right away.
+ *  Otherwise, this is the same as task_pool_submit().
+ *
+ *  @param pool  The pool
+ *  @param ptask The task, which must stay valid until task_pool_sync() is
+ *   called on it
+ *  @param func  The function run by the task
+ *  @param arg   The argument given to the function
+ *
+ *  @return void
+ */
+void task_pool_spawn(task_pool_t *pool, pool_task_t *ptask,
+                     void *(*func)(void *), void *arg) {
+
+  // Invalid parameter
+  assert(pool && ptask && func);
+
+  init_task(ptask, func, arg);
+  push_task(pool, ptask);
+}
+
+/** @brief Spawn a task in a task pool, without waiting on it
+ *
+ *  This is the same as task_pool_spawn(), except that task_pool_sync() can
+ *  not be called on the task, and that the task's record is not used anymore
+ *  once its function is called. The function is expected to hand its result
+ *  over by itself (see future.c).
+ *
+ *  @param pool  The pool
+ *  @param ptask The task, which must stay valid until its function is called
+ *  @param func  The function run by the task
+ *  @param arg   The argument given to the function
+ *
+ *  @return void
+ */
+void task_pool_spawn_detached(task_pool_t *pool, pool_task_t *ptask,
+                              void *(*func)(void *), void *arg) {
+
+  // Invalid parameter
+  assert(pool && ptask && func);
+
+  init_task(ptask, func, arg);
+  ptask->state = TASK_DETACHED;
+  push_task(pool, ptask);
+}
+
+/** @brief Run one task of a task pool on behalf of one of its workers
+ *
+ *  This lets a worker waiting for something else than a task (see
+ *  future_wait()) keep the pool busy instead of blocking.
+ *
+ *  @param pool The pool
+ *
+ *  @return 0 if a task was run, a negative number if the calling thread is
+ *   not one of the pool's workers or if no task was found
+ */
+int task_pool_run_one(task_pool_t *pool) {
+
+  // Invalid parameter
+  assert(pool);
+
+  task_pool_worker_t *worker = task_pool_my_worker(pool);
+  if (worker == NULL) {
+    return -1;
+  }
+
+  pool_task_t *ptask = find_task(worker);
+  if (ptask == NULL) {
+    return -1;
+  }
+
+  run_task(ptask);
+  return 0;
+}
+
+/** @brief Wait for a task to be done and get its result
+ *
+ *  A worker of the pool runs other tasks while it waits. Any other thread
+ *  deschedules itself until the task is done. Only one thread may wait on a
+ *  given task.
+ *
+ *  @param pool  The pool the task was submitted or spawned in
+ *  @param ptask The task
+ *
+ *  @return The value returned by the task's function
+ */
+void *task_pool_sync(task_pool_t *pool, pool_task_t *ptask) {
+
+  // Invalid parameter
+  assert(pool && ptask);
+
+  // Illegal operation. Waiting on a detached task
+  assert(ptask->state != TASK_DETACHED);
+
+  task_pool_worker_t *worker = task_pool_my_worker(pool);
+
+  if (worker != NULL) {
+    // Help the other workers until the task is done
+    while (ptask->state != TASK_DONE) {
+      pool_task_t *other = find_task(worker);
+      if (other != NULL) {
+        run_task(other);
+      } else {
+        // The task is running somewhere else, let it make progress
+        yield(-1);
+      }
+    }
+    return ptask->result;
+  }
+
+  if (ptask->state == TASK_DONE) {
+    return ptask->result;
+  }
+
+  // Describe ourselves on our own stack
+  waiter_t waiter;
+  waiter.kernel_tid = thr_get_my_kernel_id();
+  waiter.wakeup = 0;
+  ptask->waiter = &waiter;
+
+  // The task may be done by now, in which case nobody will wake us up
+  if (atomic_compare_and_swap((int *)&ptask->state, TASK_PENDING,
+                              TASK_WAITING) == TASK_PENDING) {
+
+    // Tell the scheduler to not run this thread until the task is done
+    while (!waiter.wakeup) {
+      deschedule((int *)&waiter.wakeup);
+    }
+
+    // Wait for the worker to be done with its make_runnable() call
+    spinlock_lock(&ptask->lock);
+    spinlock_unlock(&ptask->lock);
+  }
+
+  return ptask->result;
+}
@@ -7,6 +7,19 @@
 #include <global_state.h>
 #include <stdlib.h>
 #include <thr_internals.h>
+#include <mutex_asm.h>
+
+/** @brief Get the index of the slot of the stack region containing an
+ *   address below task.stack_highest_childs
+ *
+ *  @param addr The address
+ *
+ *  @return The index of the slot, 0 being the highest one
+ */
+static int stack_slot(unsigned int addr) {
+  return ((unsigned int)task.stack_highest_childs - addr) /
+         (task.stack_size + 2 * PAGE_SIZE);
+}
 
 /** @brief Get the current thread's TCB
  *
@@ -15,6 +28,13 @@
  *  This is done even before the child thread is created, which
  *  guarantees that the address is there when we get try to get it.
  *
+ *  When the stack spaces are aligned power-of-two sized regions, the end of
+ *  the current thread's stack space is found by masking the stack pointer.
+ *  Otherwise, it is computed from its distance to the highest stack space.
+ *  Threads whose stack spans several slots (see thr_create_sized()) are
+ *  found in the map of the slots of their stack instead, which is only
+ *  looked at while such a thread exists.
+ *
  *  @return Current thread's TCB
  */
 tcb_t *get_tcb() {
@@ -25,6 +45,23 @@ tcb_t *get_tcb() {
   if (esp >= (unsigned int)task.stack_highest_childs) {
     // The root thread is calling the function
     return task.root_tcb;
+  }
+
+  if (task.sized_stacks) {
+    // Our stack may span several slots, in which case the TCB pointer is not
+    // at the top of the slot we are in
+    tcb_t *tcb = tcb_directory_get(&task.stack_slots, stack_slot(esp));
+    if (tcb != NULL) {
+      return tcb;
+    }
+  }
+
+  if (task.stack_mask != 0) {
+    // The TCB pointer is right below the exception stack, which is right
+    // below the guard page ending the stack space
+    tcb_t **tcb = (tcb_t **)((esp | task.stack_mask) + 1 - 2 * PAGE_SIZE -
+                             sizeof(tcb_t *));
+    return *tcb;
 
   } else {
     unsigned int size = task.stack_size + 2 * PAGE_SIZE;
@@ -38,31 +75,53 @@ tcb_t *get_tcb() {
 
 }
 
-/** @brief Find a TCB by its library_tid
+/** @brief Put a thread whose stack spans several slots in the map of the
+ *   slots of its stack, so that get_tcb() can find it
  *
- *  @param tcb A thread's TCB
- *  @param tid A library tid
+ *  @param tcb The TCB of the thread, whose stack is set
  *
- *  @return 1 if the TCB is the good one (its library_tid is tid), 0 otherwise
+ *  @return 0 on success, a negative number on error
  */
-int find_tcb(void *tcb, void *tid) {
-  tcb_t *t = tcb;
-  int *library_tid = tid;
+int stack_slots_add(tcb_t *tcb) {
+
+  int first = stack_slot((unsigned int)tcb->stack_high);
 
-  if (t->library_tid == *library_tid) {
-    return 1;
+  int i;
+  for (i = 0; i < tcb->stack_batch->nb_slots; ++i) {
+    if (tcb_directory_add(&task.stack_slots, first + i, tcb) < 0) {
+      while (--i >= 0) {
+        tcb_directory_remove(&task.stack_slots, first + i);
+      }
+      return -1;
+    }
   }
+
+  // The thread is not running yet, it will see the count
+  atomic_add_and_update((int *)&task.sized_stacks, 1);
+
   return 0;
 }
 
-/** @brief Hash function for TCBs hash table
+/** @brief Remove a thread from the map of the slots of its stack, if its
+ *   stack spans several slots
  *
- *  @param tcb The TCB to hash
- *  @param nb_buckets The number of buckets in the hash table
+ *  @param tcb The TCB of the thread
  *
- *  @return The TCB's hashed value
+ *  @return void
  */
-unsigned int hash_function_tcb(void *tcb, unsigned int nb_buckets) {
-  tcb_t *t = tcb;
-  return t->library_tid % nb_buckets;
+void stack_slots_remove(tcb_t *tcb) {
+
+  if (tcb->stack_batch == NULL || tcb->stack_batch->nb_slots == 0) {
+    return;
+  }
+
+  int first = stack_slot((unsigned int)tcb->stack_high);
+
+  int i;
+  for (i = 0; i < tcb->stack_batch->nb_slots; ++i) {
+    tcb_directory_remove(&task.stack_slots, first + i);
+  }
+
+  // The thread has vanished (or never ran), nobody needs the map for it
+  atomic_add_and_update((int *)&task.sized_stacks, -1);
 }
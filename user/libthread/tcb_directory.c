@@ -0,0 +1,405 @@
+/** @file tcb_directory.c
+ *
+ *  @brief This file contains the definitions for functions which can be used
+ *   to manipulate the TCB directory, which maps library issued TIDs to TCBs
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <tcb_directory.h>
+#include <mutex.h>
+#include <stdlib.h>
+
+/** @brief Get the index of the slot of a TID
+ */
+#define TID_INDEX(tid) ((tid) & ((1 << TCB_DIRECTORY_INDEX_BITS) - 1))
+
+/** @brief Get the TID given out for a slot, given its index and its number
+ *   of reuses
+ */
+#define MAKE_TID(index, reuses) \
+  ((int)(((reuses) << TCB_DIRECTORY_INDEX_BITS) | (index)) & 0x7fffffff)
+
+/** @brief Get the slot of the directory for a TID
+ *
+ *  The slot is returned even if the TID was given back, see tid_matches().
+ *
+ *  @param dir  The directory
+ *  @param tid  A library issued TID
+ *
+ *  @return The slot for this TID, NULL if its chunk is not allocated
+ */
+static tcb_directory_slot_t *get_slot(tcb_directory_t *dir, int tid) {
+
+  // Check validity of arguments
+  if (tid < 0) {
+    return NULL;
+  }
+
+  int index = TID_INDEX(tid);
+  tcb_directory_slot_t *chunk =
+    *(tcb_directory_slot_t * volatile *)&dir->chunks[index >>
+                                                TCB_DIRECTORY_CHUNK_SHIFT];
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  return &chunk[index & (TCB_DIRECTORY_CHUNK_SIZE - 1)];
+}
+
+/** @brief Check that a TID is the one currently given out for its slot
+ *
+ *  @param tid    A library issued TID
+ *  @param reuses The number of reuses of the TID's slot
+ *
+ *  @return Non-zero if the TID is current, 0 if it was given back
+ */
+static int tid_matches(int tid, unsigned int reuses) {
+  return MAKE_TID(TID_INDEX(tid), reuses) == tid;
+}
+
+/** @brief Writes a new value in a slot of the directory
+ *
+ *  @param slot The slot
+ *  @param tcb  The new value
+ *
+ *  @return void
+ */
+static void write_slot(tcb_directory_slot_t *slot, struct tcb *tcb) {
+  ++slot->generation;
+  slot->tcb = tcb;
+  ++slot->generation;
+}
+
+/** @brief Reads the TCB and the number of reuses of a slot, retrying if it
+ *   raced with a writer
+ *
+ *  @param slot   The slot
+ *  @param reuses Set to the slot's number of reuses
+ *
+ *  @return The TCB in the slot, NULL if there is none
+ */
+static struct tcb *read_slot(volatile tcb_directory_slot_t *slot,
+                             unsigned int *reuses) {
+
+  unsigned int generation;
+  struct tcb *tcb;
+
+  do {
+    generation = slot->generation;
+    tcb = slot->tcb;
+    *reuses = slot->reuses;
+  } while ((generation & 1) || generation != slot->generation);
+
+  return tcb;
+}
+
+/** @brief Initialize the TCB directory
+ *
+ *  The function must be called once before any other function in this file,
+ *  otherwise the directory's behavior is undefined.
+ *
+ *  @param dir The directory to initialize
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int tcb_directory_init(tcb_directory_t *dir) {
+
+  // Check validity of arguments
+  if (dir == NULL) {
+    return -1;
+  }
+
+  int i;
+  for (i = 0; i < TCB_DIRECTORY_NB_CHUNKS; ++i) {
+    dir->chunks[i] = NULL;
+  }
+  dir->next_tid = 0;
+  dir->free_head = -1;
+  dir->free_tail = -1;
+
+  if (mutex_init(&dir->grow_lock) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/** @brief Allocate the chunk containing a TID if nobody did it before us
+ *
+ *  The caller must hold the directory's grow_lock.
+ *
+ *  @param dir  The directory
+ *  @param tid  A library issued TID
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+static int allocate_chunk(tcb_directory_t *dir, int tid) {
+
+  int index = TID_INDEX(tid) >> TCB_DIRECTORY_CHUNK_SHIFT;
+  if (dir->chunks[index] != NULL) {
+    return 0;
+  }
+
+  tcb_directory_slot_t *chunk = calloc(TCB_DIRECTORY_CHUNK_SIZE,
+                                       sizeof(tcb_directory_slot_t));
+  if (chunk == NULL) {
+    return -1;
+  }
+
+  // Publish the chunk once it is fully initialized
+  dir->chunks[index] = chunk;
+
+  return 0;
+}
+
+/** @brief Add a TCB to the directory
+ *
+ *  @param dir  The directory
+ *  @param tid  The library issued TID of the thread owning the TCB
+ *  @param tcb  The TCB
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int tcb_directory_add(tcb_directory_t *dir, int tid, struct tcb *tcb) {
+
+  // Check validity of arguments
+  if (dir == NULL || tcb == NULL || tid < 0) {
+    return -1;
+  }
+
+  tcb_directory_slot_t *slot = get_slot(dir, tid);
+
+  if (slot == NULL) {
+    mutex_lock(&dir->grow_lock);
+    int ret = allocate_chunk(dir, tid);
+    mutex_unlock(&dir->grow_lock);
+    if (ret < 0) {
+      return -1;
+    }
+    slot = get_slot(dir, tid);
+  }
+
+  if (!tid_matches(tid, slot->reuses)) {
+    // The TID was given back
+    return -1;
+  }
+
+  write_slot(slot, tcb);
+
+  return 0;
+}
+
+/** @brief Give out TIDs which are not in use, reusing the TIDs given back
+ *   with tcb_directory_free_tid() first
+ *
+ *  The chunks of the TIDs are allocated, so that adding a TCB under one of
+ *  them can not fail. Either all the TIDs are given out, or none of them is.
+ *
+ *  @param dir  The directory
+ *  @param nb   The number of TIDs
+ *  @param tids Filled with the TIDs
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int tcb_directory_new_tids(tcb_directory_t *dir, int nb, int *tids) {
+
+  // Check validity of arguments
+  if (dir == NULL || nb <= 0 || tids == NULL) {
+    return -1;
+  }
+
+  mutex_lock(&dir->grow_lock);
+
+  // Count the TIDs we can reuse
+  int nb_free = 0, tid = dir->free_head;
+  while (tid != -1 && nb_free < nb) {
+    ++nb_free;
+    tid = get_slot(dir, tid)->next_free;
+  }
+
+  // Make sure the new TIDs can be used
+  int i, fresh = dir->next_tid;
+  for (i = nb_free; i < nb; ++i, ++fresh) {
+    if ((fresh >> TCB_DIRECTORY_CHUNK_SHIFT) >= TCB_DIRECTORY_NB_CHUNKS ||
+        allocate_chunk(dir, fresh) < 0) {
+      mutex_unlock(&dir->grow_lock);
+      return -1;
+    }
+  }
+
+  // Reuse the slots whose TID was given back first, then give out new ones
+  for (i = 0; i < nb_free; ++i) {
+    tcb_directory_slot_t *slot = get_slot(dir, dir->free_head);
+    tids[i] = MAKE_TID(dir->free_head, slot->reuses);
+    dir->free_head = slot->next_free;
+  }
+  if (dir->free_head == -1) {
+    dir->free_tail = -1;
+  }
+  for (i = nb_free; i < nb; ++i) {
+    tids[i] = dir->next_tid++;
+  }
+
+  mutex_unlock(&dir->grow_lock);
+
+  return 0;
+}
+
+/** @brief Give back a TID so that its slot can be reused, once its TCB was
+ *   removed from the directory
+ *
+ *  From then on, the TID does not refer to the slot anymore: the functions
+ *  of the directory fail for it, even once the slot is given out again.
+ *
+ *  @param dir  The directory
+ *  @param tid  A TID given out by tcb_directory_new_tids()
+ *
+ *  @return void
+ */
+void tcb_directory_free_tid(tcb_directory_t *dir, int tid) {
+
+  // Check validity of arguments
+  if (dir == NULL) {
+    return;
+  }
+
+  tcb_directory_slot_t *slot = get_slot(dir, tid);
+  if (slot == NULL) {
+    return;
+  }
+
+  mutex_lock(&dir->grow_lock);
+
+  if (!tid_matches(tid, slot->reuses)) {
+    // The TID was already given back
+    mutex_unlock(&dir->grow_lock);
+    return;
+  }
+
+  // Make the TID stale, like any modification of the slot
+  ++slot->generation;
+  ++slot->reuses;
+  ++slot->generation;
+
+  int index = TID_INDEX(tid);
+  slot->next_free = -1;
+  if (dir->free_tail != -1) {
+    get_slot(dir, dir->free_tail)->next_free = index;
+  } else {
+    dir->free_head = index;
+  }
+  dir->free_tail = index;
+
+  mutex_unlock(&dir->grow_lock);
+}
+
+/** @brief Remove a TCB from the directory
+ *
+ *  @param dir  The directory
+ *  @param tid  The library issued TID of the thread owning the TCB
+ *
+ *  @return The removed TCB if it was in the directory, NULL otherwise
+ */
+struct tcb *tcb_directory_remove(tcb_directory_t *dir, int tid) {
+
+  // Check validity of arguments
+  if (dir == NULL) {
+    return NULL;
+  }
+
+  tcb_directory_slot_t *slot = get_slot(dir, tid);
+  if (slot == NULL) {
+    return NULL;
+  }
+
+  if (!tid_matches(tid, slot->reuses)) {
+    // The TID was given back
+    return NULL;
+  }
+
+  struct tcb *tcb = slot->tcb;
+  if (tcb != NULL) {
+    write_slot(slot, NULL);
+  }
+
+  return tcb;
+}
+
+/** @brief Get a TCB in the directory
+ *
+ *  This function never takes a lock, and runs in constant time regardless of
+ *  the number of threads in the task.
+ *
+ *  @param dir  The directory
+ *  @param tid  The library issued TID of the thread owning the TCB
+ *
+ *  @return The TCB if it was found in the directory. NULL otherwise.
+ */
+struct tcb *tcb_directory_get(tcb_directory_t *dir, int tid) {
+
+  // Check validity of arguments
+  if (dir == NULL) {
+    return NULL;
+  }
+
+  tcb_directory_slot_t *slot = get_slot(dir, tid);
+  if (slot == NULL) {
+    return NULL;
+  }
+
+  unsigned int reuses;
+  struct tcb *tcb = read_slot(slot, &reuses);
+
+  // The TID may have been given back, and the slot given to another thread
+  if (!tid_matches(tid, reuses)) {
+    return NULL;
+  }
+
+  return tcb;
+}
+
+/** @brief Get the number of slots of the directory which were ever used
+ *
+ *  Every TID given out so far indexes one of the first slots of the
+ *  directory, up to that number.
+ *
+ *  @param dir  The directory
+ *
+ *  @return The number of slots
+ */
+int tcb_directory_nb_slots(tcb_directory_t *dir) {
+
+  // Check validity of arguments
+  if (dir == NULL) {
+    return 0;
+  }
+
+  return *(volatile int *)&dir->next_tid;
+}
+
+/** @brief Get the TCB in a slot of the directory, whatever its TID is
+ *
+ *  Like tcb_directory_get(), this function never takes a lock, so that the
+ *  TCBs of all the threads can be looked at quickly.
+ *
+ *  @param dir    The directory
+ *  @param index  The index of the slot, below tcb_directory_nb_slots()
+ *
+ *  @return The TCB in the slot, NULL if there is none
+ */
+struct tcb *tcb_directory_get_at(tcb_directory_t *dir, int index) {
+
+  // Check validity of arguments
+  if (dir == NULL || index < 0 || index >= (1 << TCB_DIRECTORY_INDEX_BITS)) {
+    return NULL;
+  }
+
+  tcb_directory_slot_t *slot = get_slot(dir, index);
+  if (slot == NULL) {
+    return NULL;
+  }
+
+  unsigned int reuses;
+  return read_slot(slot, &reuses);
+}
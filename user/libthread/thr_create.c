@@ -4,11 +4,12 @@
  */
 
 #include <global_state.h>
-#include <hash_table.h>
 #include <page_fault_handler.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <syscall.h>
 #include <thr_internals.h>
+#include <mutex_asm.h>
 #include <thread.h>
 #include <cond.h>
 #include <simics.h>
@@ -21,32 +22,16 @@
  */
 #define FALSE 0
 
-/** @brief Create a new thread to run func(arg)
- *
- *  This function allocates a stack for the new thread and
- *  then invoke the thread_fork system call in an appropriate way.
- *  The function also create a TCB for the child thread, and put it in the
- *  TCBs hash table.
+/** @brief Allocate and initialize the TCB of a new thread
  *
- *  @param func The function to be ran by the new thread
- *  @param arg The argument to the function
- *
- *  @return The ID of the child thread on success. A negative number on error.
+ *  @return The TCB, NULL on error
  */
-int thr_create(void *(*func)(void *), void *arg) {
-
-  // Check validity of arguments
-  if (func == NULL) {
-    return -1;
-  }
-
-  // Boundaries of child's stack
-  unsigned int *child_stack_low, *child_stack_high;
+static tcb_t *new_tcb(void) {
 
   // Create new TCB for child thread
-  tcb_t *tcb = malloc(sizeof(tcb_t));
+  tcb_t *tcb = slab_alloc(&task.tcb_cache);
   if (tcb == NULL) {
-    return -1;
+    return NULL;
   }
 
   // Initialize the TCB's mutex and  condition variable
@@ -54,68 +39,73 @@ int thr_create(void *(*func)(void *), void *arg) {
       mutex_init(&tcb->mutex_state) < 0 ||
       cond_init(&tcb->cond_var_kernel_tid) < 0 ||
       mutex_init(&tcb->mutex_kernel_tid) < 0) {
-    free(tcb);
-    return -1;
+    slab_free(&task.tcb_cache, tcb);
+    return NULL;
   }
 
   tcb->return_status = NULL;
   tcb->kernel_tid = -1;
   tcb->thread_state = RUNNING;
+  tcb->waitset = NULL;
+  tcb->detached = FALSE;
+  // The child holds a pin until it vanishes, and we hold one until we are
+  // done with its TCB in start_thread()
+  tcb->pins = 2;
+  thread_cache_init(&tcb->cache);
+  slab_magazines_init(tcb->magazines);
+  thr_specific_init(tcb);
+  rwlock_biased_reads_init(tcb);
+  tcb->pool_worker = NULL;
+
+  return tcb;
+}
 
-  // Try to find space for a new stack in the queue
-  child_stack_high = queue_delete_node(&task.stack_queue);
-
-  int allocated = TRUE;
-  // Define child_stack_low/high and update global state if necessary
-  mutex_lock(&task.state_lock);
-
-  if (child_stack_high == NULL) {
-    allocated = FALSE;
-    child_stack_high = (unsigned int *)((unsigned int) task.stack_lowest - 
-                       PAGE_SIZE);
-
-    // Need space for : 1 stack + 1 page (exception stack) + 1 page (guardpage)
-    task.stack_lowest = (unsigned int *)((unsigned int)task.stack_lowest -
-                        (task.stack_size + 2 * PAGE_SIZE));
+/** @brief Give a new thread its stack
+ *
+ *  @param tcb        The TCB of the new thread
+ *  @param stack_high The highest address of the stack
+ *  @param batch      The batch of the stack
+ *
+ *  @return void
+ */
+static void set_stack(tcb_t *tcb, unsigned int *stack_high,
+                      stack_region_t *batch) {
+
+  // A stack spanning several slots also gets their guard pages and
+  // exception stacks but one
+  unsigned int size = task.stack_size;
+  if (batch->nb_slots > 0) {
+    size = batch->nb_slots * (task.stack_size + 2 * PAGE_SIZE) - 2 * PAGE_SIZE;
   }
 
-  child_stack_low = (unsigned int *)((unsigned int)child_stack_high -
-                    task.stack_size - PAGE_SIZE);
-
-  // Give the child thread a library tid
-  tcb->library_tid = task.tid;
-  ++task.tid;
-
-  mutex_unlock(&task.state_lock);
-
   // Keep track of stack boundaries in child's TCB
-  tcb->stack_low = child_stack_low;
-  tcb->stack_high = child_stack_high;
-
-  // Allocate the stack for the child
-  if (allocated == FALSE && new_pages(child_stack_low, 
-      (unsigned int)child_stack_high - (unsigned int)child_stack_low) < 0) {
-
-    // If we could not allocate stack space, put them in the queue
-    queue_insert_node(&task.stack_queue, child_stack_high);
-
-    // Free child's TCB
-    free(tcb);
-
-    return -1;
-  }
+  tcb->stack_batch = batch;
+  tcb->stack_high = stack_high;
+  tcb->stack_low = (unsigned int *)((unsigned int)stack_high - size -
+                   PAGE_SIZE);
+}
 
-  // Put the child's TCB in the hash table
-  hash_table_add_element(&task.tcbs, tcb);
+/** @brief Start a new thread whose TCB is in the directory
+ *
+ *  If the thread can not be created, its TCB is removed from the directory
+ *  and freed, and its stack is put back in the pool.
+ *
+ *  @param tcb  The TCB of the new thread
+ *  @param func The function to be ran by the new thread
+ *  @param arg  The argument to the function
+ *
+ *  @return The ID of the child thread on success. A negative number on error.
+ */
+static int start_thread(tcb_t *tcb, void *(*func)(void *), void *arg) {
 
   // Initialize the child's stack (at lower addresses than the exception stack)
   unsigned int *child_esp =
-      (unsigned int *)((unsigned int)child_stack_high - PAGE_SIZE) - 1;
+      (unsigned int *)((unsigned int)tcb->stack_high - PAGE_SIZE) - 1;
 
   *child_esp = (unsigned int)tcb; // Address of child's TCB
   --child_esp;
 
-  *child_esp = (unsigned int)child_stack_high; // Address of exception stack
+  *child_esp = (unsigned int)tcb->stack_high; // Address of exception stack
   --child_esp;
 
   *child_esp = (unsigned int)arg;
@@ -128,20 +118,24 @@ int thr_create(void *(*func)(void *), void *arg) {
   --child_esp;
   *child_esp = (unsigned int)stub; // Address of stub function
 
+  // The child may have exited by the time thread_fork() returns, but its
+  // TCB is not reclaimed before we drop our pin
+  int library_tid = tcb->library_tid;
+
   // Create the child thread with thread_fork()
   int child_tid;
   if ((child_tid = thread_fork(child_esp)) < 0) {
 
-    // De-allocate stack space
-    remove_pages(child_stack_high);
+    stack_slots_remove(tcb);
 
-    // Put stack space in the queue
-    queue_insert_node(&task.stack_queue, child_stack_high);
+    // Keep the stack space for another thread
+    stack_pool_put(&task.stacks, tcb->stack_high, tcb->stack_batch);
 
-    // Free child's TCB and remove it from hash table
-    hash_table_remove_element(&task.tcbs, tcb);
+    // Free child's TCB and remove it from the directory
+    tcb_directory_remove(&task.tcbs, tcb->library_tid);
+    tcb_directory_free_tid(&task.tcbs, library_tid);
 
-    free(tcb);
+    slab_free(&task.tcb_cache, tcb);
 
     return -1;
   }
@@ -157,7 +151,267 @@ int thr_create(void *(*func)(void *), void *arg) {
   }
   mutex_unlock(&tcb->mutex_kernel_tid);
 
-  return tcb->library_tid;
+  // We are done with the TCB, it may be reclaimed from now on
+  atomic_add_and_update((int *)&tcb->pins, -1);
+
+  return library_tid;
+}
+
+/** @brief Create a new thread to run func(arg)
+ *
+ *  This function allocates a stack for the new thread and
+ *  then invoke the thread_fork system call in an appropriate way.
+ *  The function also create a TCB for the child thread, and put it in the
+ *  TCBs directory.
+ *
+ *  @param func The function to be ran by the new thread
+ *  @param arg The argument to the function
+ *
+ *  @return The ID of the child thread on success. A negative number on error.
+ */
+int thr_create(void *(*func)(void *), void *arg) {
+
+  // Check validity of arguments
+  if (func == NULL) {
+    return -1;
+  }
+
+  // Get back the resources of the detached threads which have vanished
+  thr_reclaim_detached();
+
+  tcb_t *tcb = new_tcb();
+  if (tcb == NULL) {
+    return -1;
+  }
+
+  // Take a stack from the pool
+  stack_region_t *batch;
+  unsigned int *child_stack_high = stack_pool_get(&task.stacks, &batch);
+  if (child_stack_high == NULL) {
+    slab_free(&task.tcb_cache, tcb);
+    return -1;
+  }
+  set_stack(tcb, child_stack_high, batch);
+
+  // Give the child thread a library tid, and put its TCB in the directory
+  if (tcb_directory_new_tids(&task.tcbs, 1, &tcb->library_tid) < 0) {
+
+    // Keep the stack space for another thread
+    stack_pool_put(&task.stacks, child_stack_high, batch);
+
+    // Free child's TCB
+    slab_free(&task.tcb_cache, tcb);
+
+    return -1;
+  }
+  tcb_directory_add(&task.tcbs, tcb->library_tid, tcb);
+
+  return start_thread(tcb, func, arg);
+}
+
+/** @brief Create a new thread to run func(arg), with a stack of at least size
+ *   bytes
+ *
+ *  Stacks are carved in slots of the size given to thr_init() (plus the
+ *  exception stack and guard page), so a thread with a larger stack gets a
+ *  stack spanning several slots, which is mapped on its own and unmapped when
+ *  the thread is joined. The size given to thr_init() gives a regular stack
+ *  from the pool. A thread can not get a smaller stack than the other
+ *  threads, since a slot holds a single stack, so a smaller size is refused:
+ *  the smallest stack size used must be given to thr_init().
+ *
+ *  @param func The function to be ran by the new thread
+ *  @param arg  The argument to the function
+ *  @param size The minimum size of the thread's stack, at least the size
+ *              given to thr_init()
+ *
+ *  @return The ID of the child thread on success. A negative number on error,
+ *   in particular if size is smaller than the size given to thr_init().
+ */
+int thr_create_sized(void *(*func)(void *), void *arg, unsigned int size) {
+
+  // Check validity of arguments
+  if (func == NULL || size < task.stack_size) {
+    return -1;
+  }
+
+  if (size == task.stack_size) {
+    return thr_create(func, arg);
+  }
+
+  // Number of slots needed for the stack, its exception stack and guard page
+  unsigned int stride = task.stack_size + 2 * PAGE_SIZE;
+  if (size > UINT_MAX - (2 * PAGE_SIZE + stride - 1)) {
+    return -1;
+  }
+  int nb_slots = (size + 2 * PAGE_SIZE + stride - 1) / stride;
+
+  // The stack must fit below the lowest stack (the pool checks it again
+  // under its mutex, since task.stack_lowest may move in the meantime)
+  if ((unsigned int)nb_slots > (unsigned int)task.stack_lowest / stride) {
+    return -1;
+  }
+
+  // Get back the resources of the detached threads which have vanished
+  thr_reclaim_detached();
+
+  tcb_t *tcb = new_tcb();
+  if (tcb == NULL) {
+    return -1;
+  }
+
+  // Map the stack on its own
+  stack_region_t *batch;
+  unsigned int *child_stack_high = stack_pool_get_sized(&task.stacks, nb_slots,
+                                                        &batch);
+  if (child_stack_high == NULL) {
+    slab_free(&task.tcb_cache, tcb);
+    return -1;
+  }
+  set_stack(tcb, child_stack_high, batch);
+
+  // Give the child thread a library tid
+  if (tcb_directory_new_tids(&task.tcbs, 1, &tcb->library_tid) < 0) {
+    stack_pool_put(&task.stacks, child_stack_high, batch);
+    slab_free(&task.tcb_cache, tcb);
+    return -1;
+  }
+
+  // Put the child's TCB in the map of the slots of its stack so that it can
+  // find it, and in the directory
+  if (stack_slots_add(tcb) < 0) {
+    tcb_directory_free_tid(&task.tcbs, tcb->library_tid);
+    stack_pool_put(&task.stacks, child_stack_high, batch);
+    slab_free(&task.tcb_cache, tcb);
+    return -1;
+  }
+  tcb_directory_add(&task.tcbs, tcb->library_tid, tcb);
+
+  return start_thread(tcb, func, arg);
+}
+
+/** @brief Create nb new threads, the i-th one running func(args[i]), using
+ *   arrays provided by the caller to hold their resources
+ *
+ *  @param nb      The number of threads to create
+ *  @param func    The function to be ran by the new threads
+ *  @param args    The arguments to the function, or NULL
+ *  @param tids    Filled with the IDs of the threads created
+ *  @param tcbs    An array of nb TCB pointers
+ *  @param stacks  An array of nb stack pointers
+ *  @param batches An array of nb batch pointers
+ *
+ *  @return The number of threads created (nb on success). A negative number
+ *   if no thread could be created.
+ */
+static int create_n(int nb, void *(*func)(void *), void **args, int *tids,
+                    tcb_t **tcbs, unsigned int **stacks,
+                    stack_region_t **batches) {
+
+  int i;
+
+  // Create the TCBs
+  for (i = 0; i < nb; ++i) {
+    tcbs[i] = new_tcb();
+    if (tcbs[i] == NULL) {
+      while (--i >= 0) {
+        slab_free(&task.tcb_cache, tcbs[i]);
+      }
+      return -1;
+    }
+  }
+
+  // Take all the stacks from the pool
+  if (stack_pool_get_n(&task.stacks, nb, stacks, batches) < 0) {
+    for (i = 0; i < nb; ++i) {
+      slab_free(&task.tcb_cache, tcbs[i]);
+    }
+    return -1;
+  }
+
+  // Give the child threads their library tids at once
+  if (tcb_directory_new_tids(&task.tcbs, nb, tids) < 0) {
+    for (i = 0; i < nb; ++i) {
+      stack_pool_put(&task.stacks, stacks[i], batches[i]);
+      slab_free(&task.tcb_cache, tcbs[i]);
+    }
+    return -1;
+  }
+
+  // Put the children's TCBs in the directory
+  for (i = 0; i < nb; ++i) {
+    set_stack(tcbs[i], stacks[i], batches[i]);
+    tcbs[i]->library_tid = tids[i];
+    tcb_directory_add(&task.tcbs, tids[i], tcbs[i]);
+  }
+
+  // Start the threads
+  for (i = 0; i < nb; ++i) {
+    tids[i] = start_thread(tcbs[i], func, (args == NULL) ? NULL : args[i]);
+    if (tids[i] < 0) {
+      break;
+    }
+  }
+
+  // Clean up after the threads which were not started (start_thread() did
+  // it for the one which failed)
+  int nb_created = i;
+  while (++i < nb) {
+    tcb_directory_remove(&task.tcbs, tcbs[i]->library_tid);
+    tcb_directory_free_tid(&task.tcbs, tcbs[i]->library_tid);
+    stack_pool_put(&task.stacks, stacks[i], batches[i]);
+    slab_free(&task.tcb_cache, tcbs[i]);
+  }
+
+  return (nb_created > 0) ? nb_created : -1;
+}
+
+/** @brief Create nb new threads, the i-th one running func(args[i])
+ *
+ *  This is faster than calling thr_create() nb times: the stacks are taken
+ *  from the pool at once, and the library tids are given out at once. The
+ *  stacks missing from the pool are mapped with a single system call (unless
+ *  it fails, in which case smaller batches are tried), even if batching was
+ *  not enabled with thr_stack_watermarks(). The stacks mapped by that call,
+ *  but the lowest one, therefore have no guard page to catch overflows.
+ *
+ *  If a thread can not be created, no more threads are created, but the
+ *  threads created so far keep running.
+ *
+ *  @param nb   The number of threads to create
+ *  @param func The function to be ran by the new threads
+ *  @param args The arguments to the function, or NULL to give NULL to every
+ *   thread
+ *  @param tids Filled with the IDs of the threads created
+ *
+ *  @return The number of threads created (nb on success). A negative number
+ *   if no thread could be created.
+ */
+int thr_create_n(int nb, void *(*func)(void *), void **args, int *tids) {
+
+  // Check validity of arguments
+  if (nb <= 0 || func == NULL || tids == NULL) {
+    return -1;
+  }
+
+  // Get back the resources of the detached threads which have vanished
+  thr_reclaim_detached();
+
+  // calloc() fails if the size of an array overflows
+  tcb_t **tcbs = calloc(nb, sizeof(tcb_t *));
+  unsigned int **stacks = calloc(nb, sizeof(unsigned int *));
+  stack_region_t **batches = calloc(nb, sizeof(stack_region_t *));
+
+  int nb_created = -1;
+  if (tcbs != NULL && stacks != NULL && batches != NULL) {
+    nb_created = create_n(nb, func, args, tids, tcbs, stacks, batches);
+  }
+
+  free(tcbs);
+  free(stacks);
+  free(batches);
+
+  return nb_created;
 }
 
 /** @brief Stub function for newly created thread
@@ -0,0 +1,122 @@
+/** @file thr_detach.c
+ *
+ *  @brief This file contains the definitions for the functions detaching
+ *   threads and reclaiming their resources
+ *
+ *  A thread can not free its own stack, since it still runs on it until it
+ *  vanishes, and its TCB is used until then too. When a detached thread
+ *  exits, it puts its TCB on a task-wide list of exited detached threads
+ *  instead. The TCBs and stacks of the threads on that list are reclaimed by
+ *  the next thread calling thr_create() or thr_detach(), once their pin
+ *  count dropped to 0: the exiting thread drops its pin in thr_vanish(),
+ *  which traps into vanish() right away without touching the stack.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <thr_detach.h>
+#include <global_state.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include <thr_internals.h>
+
+/** @brief A macro to consider 1 as true
+ */
+#define TRUE 1
+
+/** @brief Puts an exited detached thread on the task's list of exited
+ *   detached threads
+ *
+ *  @param tcb The TCB of the exited thread
+ *
+ *  @return void
+ */
+void thr_detached_exited(tcb_t *tcb) {
+
+  spinlock_lock(&task.detached_lock);
+  tcb->waitset_next = task.detached_exited;
+  task.detached_exited = tcb;
+  spinlock_unlock(&task.detached_lock);
+}
+
+/** @brief Reclaims the TCB and stack of every exited detached thread which
+ *   is done with them
+ *
+ *  Threads which have not vanished yet are left on the list, and are given
+ *  the CPU so that they can vanish before the next attempt.
+ *
+ *  @return void
+ */
+void thr_reclaim_detached(void) {
+
+  // Don't bother taking the lock when there is obviously nothing to reclaim
+  if (task.detached_exited == NULL) {
+    return;
+  }
+
+  // Take the whole list, so that reclaiming is done without the lock
+  spinlock_lock(&task.detached_lock);
+  tcb_t *exited = task.detached_exited;
+  task.detached_exited = NULL;
+  spinlock_unlock(&task.detached_lock);
+
+  while (exited != NULL) {
+    tcb_t *tcb = exited;
+    exited = tcb->waitset_next;
+
+    if (tcb->pins == 0) {
+      // Nothing will touch the TCB or the stack anymore
+      thr_reap(tcb, NULL);
+    } else {
+      // Let the thread reach vanish()
+      if (tcb->kernel_tid != -1) {
+        yield(tcb->kernel_tid);
+      }
+      thr_detached_exited(tcb);
+    }
+  }
+}
+
+/** @brief Detaches a thread, so that its TCB and stack are reclaimed
+ *   automatically after it exits instead of when it is joined
+ *
+ *  A detached thread can not be joined anymore.
+ *
+ *  @param tid The library tid of the thread
+ *
+ *  @return 0 on success, a negative number if the tid is invalid, or if the
+ *   thread is being joined, is in a waitset or is detached already
+ */
+int thr_detach(int tid) {
+
+  // Get back the resources of the detached threads which have vanished
+  thr_reclaim_detached();
+
+  tcb_t *tcb = tcb_directory_get(&task.tcbs, tid);
+  if (tcb == NULL) {
+    return -1;
+  }
+
+  mutex_lock(&tcb->mutex_state);
+
+  // Another thread or set is already waiting on this thread, or it is
+  // detached already
+  if (tcb->thread_state == WAITING_ON) {
+    mutex_unlock(&tcb->mutex_state);
+    return -1;
+  }
+
+  int exited = (tcb->thread_state == EXITED);
+
+  tcb->detached = TRUE;
+  tcb->thread_state = WAITING_ON;
+
+  mutex_unlock(&tcb->mutex_state);
+
+  // The thread may not have vanished yet, let the reclaimer check
+  if (exited) {
+    thr_detached_exited(tcb);
+  }
+
+  return 0;
+}
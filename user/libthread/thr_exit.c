@@ -28,9 +28,24 @@ void thr_exit(void *status) {
   // Set return status
   tcb->return_status = status;
 
+  // Run the destructors of our thread-specific data
+  thr_specific_destroy(tcb);
+
+  // Give our cached memory blocks and objects back to the heap and caches
+  thread_cache_flush(&tcb->cache);
+  slab_magazines_flush(tcb->magazines);
+
   mutex_lock(&tcb->mutex_state);
 
-  if (tcb->thread_state == WAITING_ON) {
+  // Nobody will join a detached thread, it is reclaimed once it vanished
+  int detached = tcb->detached;
+
+  if (detached) {
+    // Keep the thread WAITING_ON so that thr_join() still refuses to join it
+  } else if (tcb->thread_state == WAITING_ON && tcb->waitset != NULL) {
+    // We belong to a waitset, let a thread joining the set reap us
+    thr_waitset_exited(tcb->waitset, tcb);
+  } else if (tcb->thread_state == WAITING_ON) {
     // Some other thread has called thr_join() on this thread
     cond_signal(&tcb->cond_var_state);
   } else {
@@ -40,7 +55,13 @@ void thr_exit(void *status) {
 
   mutex_unlock(&tcb->mutex_state);
 
+  if (detached) {
+    thr_detached_exited(tcb);
+  }
+
   set_status((int)status);
-  // Vanish the current thread
-  vanish();
+
+  // Vanish the current thread, letting the other threads know our TCB and
+  // stack are not used anymore
+  thr_vanish(&tcb->pins);
 }
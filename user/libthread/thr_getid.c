@@ -5,7 +5,6 @@
  */
 
 #include <global_state.h>
-#include <hash_table.h>
 #include <stdlib.h>
 #include <thr_internals.h>
 #include <cond.h>
@@ -35,7 +34,7 @@ int thr_getid() {
  */
 int thr_get_kernel_id(int library_tid) {
 
-  tcb_t *tcb = hash_table_get_element(&task.tcbs, &library_tid);
+  tcb_t *tcb = tcb_directory_get(&task.tcbs, library_tid);
 
   assert(tcb != NULL);
 
@@ -84,3 +83,26 @@ int thr_get_my_kernel_id() {
 
   return tcb->kernel_tid;
 }
+
+/** @brief Allows a thread to know its own kernel issued tid without taking
+ *   any lock or making any system call
+ *
+ *  This is used by mutex_lock() itself, hence it can not rely on the TCB's
+ *  mutex. It may also be called before thr_init(), in which case there is no
+ *  TCB yet. The kernel_tid field is only ever written once, from -1 to its
+ *  final value, so reading it without the lock is safe.
+ *
+ *  @return The kernel level id of the calling thread if it is already known,
+ *   -1 otherwise
+ */
+int thr_get_my_kernel_id_nolock(void) {
+
+  // Get TCB of current thread (NULL if thr_init() was not called yet)
+  tcb_t *tcb = get_tcb();
+
+  if (tcb == NULL) {
+    return -1;
+  }
+
+  return tcb->kernel_tid;
+}
@@ -4,28 +4,30 @@
  */
 
 #include <global_state.h>
-#include <hash_table.h>
 #include <page_fault_handler.h>
 #include <stdlib.h>
 #include <syscall.h>
 #include <thread.h>
 #include <cond.h>
 
-/** @brief Number of buckets for the hash table containing the TCBs
+/** @brief A macro to consider 1 as true
  */
-#define NB_BUCKETS_TCB 32
+#define TRUE 1
+
+/** @brief A macro to consider 0 as false
+ */
+#define FALSE 0
 
 /** @brief Initialize the thread library
  *
- *  This function should be called exactly once before any other
- *  function from the thread library.
- *
- *  @param size The amount of stack space which will be available for
+ *  @param size    The amount of stack space which will be available for
  *  each thread using the thread library
+ *  @param aligned TRUE to give each thread an aligned power-of-two sized
+ *  stack space, FALSE otherwise
  *
- *  @return Zero on success, a negative number on erro
+ *  @return Zero on success, a negative number on error
  */
-int thr_init(unsigned int size) {
+static int init(unsigned int size, int aligned) {
 
   // Check validity of argument
   if (size == 0) {
@@ -37,21 +39,40 @@ int thr_init(unsigned int size) {
     size += (PAGE_SIZE - mod);
   }
 
+  // Size of a thread's stack space minus one if it is aligned, 0 otherwise
+  unsigned int mask = 0;
+
+  if (aligned == TRUE) {
+    // Round the stack space (stack + exception stack + guard page) up to a
+    // power of two, and give the extra space to the stack
+    unsigned int stride = PAGE_SIZE;
+    while (stride < size + 2 * PAGE_SIZE) {
+      stride *= 2;
+      if (stride == 0) {
+        return -1;
+      }
+    }
+    size = stride - 2 * PAGE_SIZE;
+    mask = stride - 1;
+  }
+
   // Initialize the task's global state
 
   // Initialize data structures
-  if (queue_init(&task.stack_queue) < 0 || hash_table_init(&task.tcbs,
-      NB_BUCKETS_TCB, find_tcb, hash_function_tcb) < 0) {
+  if (stack_pool_init(&task.stacks) < 0 ||
+      tcb_directory_init(&task.tcbs) < 0 ||
+      tcb_directory_init(&task.stack_slots) < 0 ||
+      slab_cache_init(&task.tcb_cache, sizeof(tcb_t)) < 0) {
     return -1;
   }
 
-  // Initialize mutexes
-  if (mutex_init(&task.state_lock) < 0) {
-    return -1;
-  }
+  // Initialize the list of exited detached threads
+  task.detached_exited = NULL;
+  task.sized_stacks = 0;
+  spinlock_init(&task.detached_lock);
 
   // Create TCB for current task
-  tcb_t *tcb = malloc(sizeof(tcb_t));
+  tcb_t *tcb = slab_alloc(&task.tcb_cache);
   if (tcb == NULL) {
     return -1;
   }
@@ -59,29 +80,42 @@ int thr_init(unsigned int size) {
   // Initialize the TCB
   tcb->return_status = NULL;
   tcb->kernel_tid = gettid();
-  tcb->library_tid = 0;
   tcb->stack_low = task.stack_lowest;
   tcb->stack_high = task.stack_highest;
+  tcb->stack_batch = NULL;
   tcb->thread_state = RUNNING;
+  tcb->waitset = NULL;
+  tcb->detached = FALSE;
+  tcb->pins = 1;
+  thread_cache_init(&tcb->cache);
+  slab_magazines_init(tcb->magazines);
+  thr_specific_init(tcb);
+  rwlock_biased_reads_init(tcb);
+  tcb->pool_worker = NULL;
 
   // Initialize the TCB's mutex and  condition variable
   if (cond_init(&tcb->cond_var_state) < 0 ||
       mutex_init(&tcb->mutex_state) < 0 ||
       cond_init(&tcb->cond_var_kernel_tid) < 0 ||
       mutex_init(&tcb->mutex_kernel_tid) < 0) {
-    free(tcb);
+    slab_free(&task.tcb_cache, tcb);
     return -1;
   }
 
-  // Add the current thread's TCB to the hash table
-  if (hash_table_add_element(&task.tcbs, tcb) < 0) {
-    free(tcb);
+  // Add the current thread's TCB to the directory, under the first tid
+  if (tcb_directory_new_tids(&task.tcbs, 1, &tcb->library_tid) < 0) {
+    slab_free(&task.tcb_cache, tcb);
     return -1;
   }
+  tcb_directory_add(&task.tcbs, tcb->library_tid, tcb);
 
   // Finish to initialize the task's global state
   task.stack_size = size;
-  task.tid = 1;
+  task.stack_mask = mask;
+
+  // With aligned stack spaces, the first one ends on a multiple of its size
+  task.stack_lowest = (unsigned int *)((unsigned int)task.stack_lowest &
+                                       ~mask);
   task.stack_highest_childs = (unsigned int*)((unsigned int)task.stack_lowest
                                - PAGE_SIZE);
   task.root_tcb = tcb;
@@ -91,3 +125,35 @@ int thr_init(unsigned int size) {
 
   return 0;
 }
+
+/** @brief Initialize the thread library
+ *
+ *  This function should be called exactly once before any other
+ *  function from the thread library.
+ *
+ *  @param size The amount of stack space which will be available for
+ *  each thread using the thread library
+ *
+ *  @return Zero on success, a negative number on erro
+ */
+int thr_init(unsigned int size) {
+  return init(size, FALSE);
+}
+
+/** @brief Initialize the thread library, giving each thread an aligned
+ *   power-of-two sized stack space
+ *
+ *  This function may be called instead of thr_init(). The stack space of
+ *  each thread (stack, exception stack and guard page) is rounded up to a
+ *  power of two and aligned on its size, and the extra space is given to the
+ *  stack. A thread can then find its TCB by masking its stack pointer, which
+ *  makes every function of the library a bit faster.
+ *
+ *  @param size The minimum amount of stack space which will be available
+ *  for each thread using the thread library
+ *
+ *  @return Zero on success, a negative number on error
+ */
+int thr_init_aligned(unsigned int size) {
+  return init(size, TRUE);
+}
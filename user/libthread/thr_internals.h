@@ -27,12 +27,36 @@ int thread_fork(void *child_esp);
  */
 unsigned int get_esp(void);
 
+/** @brief An assembly function dropping a pin on a TCB and vanishing, without
+ *   touching the stack in between
+ *
+ *  @param pins A pointer to the pin count of the calling thread's TCB
+ *
+ *  @return Do not return
+ */
+void thr_vanish(volatile int *pins);
+
 void stub(void *(*func)(void *), void *arg, void* addr_exception_stack);
 tcb_t* get_tcb(void);
-int find_tcb(void* tcb, void* tid);
-unsigned int hash_function_tcb(void* tcb, unsigned int nb_buckets);
+int stack_slots_add(tcb_t *tcb);
+void stack_slots_remove(tcb_t *tcb);
+
+int mutex_requeue_waiter(mutex_t *mp, waiter_t *waiter);
 
 int thr_get_kernel_id(int library_tid);
 int thr_get_my_kernel_id();
+int thr_get_my_kernel_id_nolock(void);
+
+void thr_specific_init(tcb_t *tcb);
+void thr_specific_destroy(tcb_t *tcb);
+
+void rwlock_biased_reads_init(tcb_t *tcb);
+
+void thr_reap(tcb_t *tcb, void **statusp);
+void thr_waitset_exited(thr_waitset_t *waitset, tcb_t *tcb);
+void thr_detached_exited(tcb_t *tcb);
+void thr_reclaim_detached(void);
+
+task_pool_worker_t *task_pool_my_worker(task_pool_t *pool);
 
 #endif /* THR_INTERNALS_H */
@@ -4,7 +4,6 @@
  */
 
 #include <global_state.h>
-#include <hash_table.h>
 #include <stdlib.h>
 #include <syscall.h>
 #include <thr_internals.h>
@@ -28,7 +27,7 @@
 int thr_join(int tid, void **statusp) {
 
   // Get the TCB of the thread we want to join on
-  tcb_t *tcb = hash_table_get_element(&task.tcbs, &tid);
+  tcb_t *tcb = tcb_directory_get(&task.tcbs, tid);
 
   // The thread already exited and was joined on or the tid is invalid
   if (tcb == NULL) {
@@ -55,24 +54,47 @@ int thr_join(int tid, void **statusp) {
   // We don't need the mutex anymore
   mutex_unlock(&tcb->mutex_state);
 
+  thr_reap(tcb, statusp);
+
+  return 0;
+}
+
+/** @brief Cleans up after a thread which has exited, optionnaly returning the
+ *   status information provided by the thread at the time of exit
+ *
+ *  The TCB and the stack are only reclaimed once the thread has dropped its
+ *  pin on them, right before vanishing.
+ *
+ *  @param tcb      The TCB of the exited thread
+ *  @param statusp  Pointer to the thread's exit status (void*)
+ *
+ *  @return void
+ */
+void thr_reap(tcb_t *tcb, void **statusp) {
+
+  // The thread may not have vanished yet, and still runs on its stack (and
+  // looks up its TCB through the map of stack slots). Let it get there
+  while (tcb->pins != 0) {
+    yield(tcb->kernel_tid);
+  }
+
   // Take care of returning the status of the exited thread
   if (statusp != NULL) {
     *statusp = tcb->return_status;
   }
 
-  // Remove TCB from hash table
-  hash_table_remove_element(&task.tcbs, &tid);
+  // Remove TCB from the directory, its tid may now be given to a new thread
+  tcb_directory_remove(&task.tcbs, tcb->library_tid);
+  tcb_directory_free_tid(&task.tcbs, tcb->library_tid);
 
   // Mark the deallocated pages as free to use for other threads if this isn't
   // the root thread
-  if ((unsigned int)tcb->stack_low !=
-      (unsigned int)task.stack_highest_childs + PAGE_SIZE) {
+  if (tcb->stack_batch != NULL) {
 
-    queue_insert_node(&task.stack_queue, tcb->stack_high);
+    stack_slots_remove(tcb);
+    stack_pool_put(&task.stacks, tcb->stack_high, tcb->stack_batch);
   }
 
   // Free the TCB data structure
-  free(tcb);
-
-  return 0;
+  slab_free(&task.tcb_cache, tcb);
 }
@@ -0,0 +1,305 @@
+/** @file thr_specific.c
+ *
+ *  @brief This file contains the definitions for the thread-specific data
+ *   functions
+ *
+ *  Each thread stores the values of the first THR_SPECIFIC_INLINE key slots
+ *  in its TCB, and the values of the other slots in a table allocated the
+ *  first time it sets one of them, so getting a value never takes a lock.
+ *  The slot of a deleted key is reused by a key created later, under a new
+ *  generation. Every value remembers the key it was set for, so a value set
+ *  for a deleted key is never seen through a new key.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <thr_specific.h>
+#include <global_state.h>
+#include <stdlib.h>
+#include <spinlock.h>
+#include <thr_internals.h>
+
+/** @brief A macro for 0 being treated as FALSE
+ */
+#define FALSE 0
+
+/** @brief A macro for 1 being treated as TRUE
+ */
+#define TRUE 1
+
+/** @brief State of a key slot which is not used by any key
+ */
+#define KEY_UNUSED 0
+
+/** @brief State of a key slot used by a key which can be used
+ */
+#define KEY_IN_USE 1
+
+/** @brief Get the index of the slot of a key
+ */
+#define KEY_INDEX(key) ((key) & (THR_KEYS_MAX - 1))
+
+/** @brief Get the key of a slot, given its index and its generation
+ */
+#define MAKE_KEY(index, generation) \
+  ((int)(((generation) << THR_KEYS_SHIFT) | (index)) & 0x7fffffff)
+
+/** @brief Number of key slots used so far (at most THR_KEYS_MAX)
+ */
+static int nb_slots = 0;
+
+/** @brief Slots of deleted keys which can be reused, as a stack linked
+ *   through next_free (-1 if there is none)
+ */
+static int free_head = -1;
+
+/** @brief The next slot in the stack of free slots, for each free slot
+ */
+static int next_free[THR_KEYS_MAX];
+
+/** @brief A spinlock protecting the allocation of slots (zeroed, hence
+ *   unlocked, before any call)
+ */
+static spinlock_t keys_lock;
+
+/** @brief State of each key slot
+ */
+static volatile int key_states[THR_KEYS_MAX];
+
+/** @brief Generation of each key slot, incremented when its key is deleted
+ */
+static volatile unsigned int generations[THR_KEYS_MAX];
+
+/** @brief Destructor of each key slot
+ */
+static void (*destructors[THR_KEYS_MAX])(void *);
+
+/** @brief Check that a key can be used
+ *
+ *  @param key The key
+ *
+ *  @return TRUE if the key was created and not deleted, FALSE otherwise
+ */
+static int valid_key(thr_key_t key) {
+
+  if (key < 0) {
+    return FALSE;
+  }
+
+  int index = KEY_INDEX(key);
+  return key_states[index] == KEY_IN_USE &&
+         MAKE_KEY(index, generations[index]) == key;
+}
+
+/** @brief Get the entry holding a thread's value for a key slot
+ *
+ *  @param tcb    The thread's TCB
+ *  @param index  The index of the key slot
+ *  @param create TRUE to allocate the thread's table of values if the slot
+ *                needs it, FALSE otherwise
+ *
+ *  @return The entry, NULL if it is in a table which does not exist
+ */
+static thr_specific_value_t *get_entry(tcb_t *tcb, int index, int create) {
+
+  if (index < THR_SPECIFIC_INLINE) {
+    return &tcb->specific[index];
+  }
+
+  if (tcb->specific_spill == NULL) {
+    if (create == FALSE) {
+      return NULL;
+    }
+    tcb->specific_spill = calloc(THR_KEYS_MAX - THR_SPECIFIC_INLINE,
+                                 sizeof(thr_specific_value_t));
+    if (tcb->specific_spill == NULL) {
+      return NULL;
+    }
+  }
+
+  return &tcb->specific_spill[index - THR_SPECIFIC_INLINE];
+}
+
+/** @brief Create a key for thread-specific data
+ *
+ *  Every thread's value for the new key is NULL. The slot of a deleted key
+ *  is reused if there is one.
+ *
+ *  @param key        Where to store the new key
+ *  @param destructor A function called with a thread's value for the key
+ *                    when the thread exits if the value is not NULL, or NULL
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int thr_key_create(thr_key_t *key, void (*destructor)(void *)) {
+
+  // Check validity of argument
+  if (key == NULL) {
+    return -1;
+  }
+
+  spinlock_lock(&keys_lock);
+
+  int index;
+  if (free_head != -1) {
+    // Reuse the slot of a deleted key
+    index = free_head;
+    free_head = next_free[index];
+  } else if (nb_slots < THR_KEYS_MAX) {
+    index = nb_slots++;
+  } else {
+    // No key left
+    spinlock_unlock(&keys_lock);
+    return -1;
+  }
+
+  destructors[index] = destructor;
+  key_states[index] = KEY_IN_USE;
+  thr_key_t new_key = MAKE_KEY(index, generations[index]);
+
+  spinlock_unlock(&keys_lock);
+
+  *key = new_key;
+
+  return 0;
+}
+
+/** @brief Delete a key for thread-specific data
+ *
+ *  The values of the threads for the key are forgotten, without calling the
+ *  key's destructor on them. The key's slot may be used by a key created
+ *  later, which does not see these values.
+ *
+ *  @param key The key
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int thr_key_delete(thr_key_t key) {
+
+  spinlock_lock(&keys_lock);
+
+  if (!valid_key(key)) {
+    spinlock_unlock(&keys_lock);
+    return -1;
+  }
+
+  int index = KEY_INDEX(key);
+  key_states[index] = KEY_UNUSED;
+  ++generations[index];
+
+  next_free[index] = free_head;
+  free_head = index;
+
+  spinlock_unlock(&keys_lock);
+
+  return 0;
+}
+
+/** @brief Get the calling thread's value for a key
+ *
+ *  @param key The key
+ *
+ *  @return The value, NULL if it was not set or if the key is invalid
+ */
+void *thr_getspecific(thr_key_t key) {
+
+  tcb_t *tcb = get_tcb();
+
+  if (tcb == NULL || !valid_key(key)) {
+    return NULL;
+  }
+
+  thr_specific_value_t *entry = get_entry(tcb, KEY_INDEX(key), FALSE);
+
+  // A value set for a deleted key of the same slot is not ours
+  if (entry == NULL || entry->key != key) {
+    return NULL;
+  }
+
+  return entry->value;
+}
+
+/** @brief Set the calling thread's value for a key
+ *
+ *  @param key   The key
+ *  @param value The value
+ *
+ *  @return 0 on success, a negative error code on failure
+ */
+int thr_setspecific(thr_key_t key, void *value) {
+
+  tcb_t *tcb = get_tcb();
+
+  if (tcb == NULL || !valid_key(key)) {
+    return -1;
+  }
+
+  thr_specific_value_t *entry = get_entry(tcb, KEY_INDEX(key), TRUE);
+  if (entry == NULL) {
+    return -1;
+  }
+
+  entry->key = key;
+  entry->value = value;
+
+  return 0;
+}
+
+/** @brief Initialize the thread-specific data of a thread
+ *
+ *  @param tcb The thread's TCB
+ *
+ *  @return void
+ */
+void thr_specific_init(tcb_t *tcb) {
+
+  int i;
+  for (i = 0; i < THR_SPECIFIC_INLINE; ++i) {
+    tcb->specific[i].value = NULL;
+    tcb->specific[i].key = -1;
+  }
+
+  tcb->specific_spill = NULL;
+}
+
+/** @brief Run the destructors on the calling thread's values and free its
+ *   table of values
+ *
+ *  A value is reset to NULL before its destructor is called. Destructors may
+ *  set new values, so the keys are looked at again, up to
+ *  THR_DESTRUCTOR_ITERATIONS times.
+ *
+ *  @param tcb The calling thread's TCB
+ *
+ *  @return void
+ */
+void thr_specific_destroy(tcb_t *tcb) {
+
+  int iteration, called = TRUE;
+
+  for (iteration = 0; iteration < THR_DESTRUCTOR_ITERATIONS && called;
+       ++iteration) {
+    called = FALSE;
+
+    int index;
+    for (index = 0; index < nb_slots; ++index) {
+      thr_specific_value_t *entry = get_entry(tcb, index, FALSE);
+      if (entry == NULL || entry->value == NULL) {
+        continue;
+      }
+
+      void *value = entry->value;
+      entry->value = NULL;
+
+      // The value may have been set for a key which was deleted since
+      void (*destructor)(void *) = destructors[index];
+      if (valid_key(entry->key) && destructor != NULL) {
+        destructor(value);
+        called = TRUE;
+      }
+    }
+  }
+
+  free(tcb->specific_spill);
+  tcb->specific_spill = NULL;
+}
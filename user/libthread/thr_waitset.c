@@ -0,0 +1,199 @@
+/** @file thr_waitset.c
+ *
+ *  @brief This file contains the definitions for the waitset functions
+ *
+ *  A waitset lets a thread join whichever thread of a set exits first,
+ *  without a wrapper around the threads' bodies. A thread added to a set is
+ *  marked WAITING_ON in its TCB, as if a thread was already joining it, so
+ *  thr_join() refuses to join it. When it exits, thr_exit() appends its TCB
+ *  to the set's list of exited threads and signals the set's condition
+ *  variable once, waking up a single joining thread.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <thr_waitset.h>
+#include <global_state.h>
+#include <stdlib.h>
+#include <mutex.h>
+#include <cond.h>
+#include <assert.h>
+#include <thr_internals.h>
+
+/** @brief Append an exited thread to its waitset's list of exited threads
+ *   and wake up a thread joining the set, if any
+ *
+ *  This is called by thr_exit(), or by thr_waitset_add() for a thread which
+ *  exited before it was added to the set. The caller must hold the thread's
+ *  state mutex.
+ *
+ *  @param waitset The set
+ *  @param tcb     The TCB of the exited thread
+ *
+ *  @return void
+ */
+void thr_waitset_exited(thr_waitset_t *waitset, tcb_t *tcb) {
+
+  mutex_lock(&waitset->mp);
+
+  tcb->waitset_next = NULL;
+  if (waitset->exited_tail == NULL) {
+    waitset->exited_head = tcb;
+  } else {
+    waitset->exited_tail->waitset_next = tcb;
+  }
+  waitset->exited_tail = tcb;
+
+  cond_signal(&waitset->cv);
+
+  mutex_unlock(&waitset->mp);
+}
+
+/** @brief Initializes a waitset
+ *
+ *  @param waitset The set to initialize
+ *
+ *  @return 0 on success, a negative number on error
+ */
+int thr_waitset_init(thr_waitset_t *waitset) {
+
+  // Check validity of arguments
+  if (waitset == NULL) {
+    return -1;
+  }
+
+  if (mutex_init(&waitset->mp) < 0 || cond_init(&waitset->cv) < 0) {
+    return -1;
+  }
+
+  waitset->nb_members = 0;
+  waitset->exited_head = NULL;
+  waitset->exited_tail = NULL;
+
+  return 0;
+}
+
+/** @brief Destroys a waitset
+ *
+ *  It is illegal to destroy a set which has threads that were not joined.
+ *
+ *  @param waitset The set to destroy
+ *
+ *  @return void
+ */
+void thr_waitset_destroy(thr_waitset_t *waitset) {
+
+  // Invalid parameter
+  assert(waitset);
+
+  mutex_lock(&waitset->mp);
+
+  // Illegal operation. Destroying a set with threads left to join
+  assert(waitset->nb_members == 0);
+
+  mutex_unlock(&waitset->mp);
+
+  cond_destroy(&waitset->cv);
+  mutex_destroy(&waitset->mp);
+}
+
+/** @brief Adds a thread to a waitset
+ *
+ *  The thread may have exited already. Once it is in the set, it can only be
+ *  joined through thr_waitset_join().
+ *
+ *  @param waitset The set
+ *  @param tid     The library tid of the thread
+ *
+ *  @return 0 on success, a negative number if the tid is invalid, or if the
+ *   thread is being joined or is in a set already
+ */
+int thr_waitset_add(thr_waitset_t *waitset, int tid) {
+
+  // Invalid parameter
+  assert(waitset);
+
+  tcb_t *tcb = tcb_directory_get(&task.tcbs, tid);
+  if (tcb == NULL) {
+    return -1;
+  }
+
+  mutex_lock(&tcb->mutex_state);
+
+  // Another thread or set is already waiting on this thread
+  if (tcb->thread_state == WAITING_ON) {
+    mutex_unlock(&tcb->mutex_state);
+    return -1;
+  }
+
+  mutex_lock(&waitset->mp);
+  ++waitset->nb_members;
+  mutex_unlock(&waitset->mp);
+
+  if (tcb->thread_state == EXITED) {
+    thr_waitset_exited(waitset, tcb);
+  } else {
+    // thr_exit() will hand the thread over to the set
+    tcb->waitset = waitset;
+  }
+
+  tcb->thread_state = WAITING_ON;
+
+  mutex_unlock(&tcb->mutex_state);
+
+  return 0;
+}
+
+/** @brief Joins whichever thread of a waitset exits first, optionally
+ *   returning its tid and the status it provided at the time of exit
+ *
+ *  If no thread of the set has exited yet, the calling thread is suspended
+ *  until one does. Each exiting thread wakes up a single joining thread.
+ *
+ *  @param waitset  The set
+ *  @param tidp     If not NULL, the library tid of the joined thread is
+ *   stored there
+ *  @param statusp  If not NULL, the thread's exit status is stored there
+ *
+ *  @return 0 on success, a negative number if every thread of the set has
+ *   already been joined (or is about to be by another thread)
+ */
+int thr_waitset_join(thr_waitset_t *waitset, int *tidp, void **statusp) {
+
+  // Invalid parameter
+  assert(waitset);
+
+  mutex_lock(&waitset->mp);
+
+  // Members being joined by other threads are not counted anymore
+  if (waitset->nb_members == 0) {
+    mutex_unlock(&waitset->mp);
+    return -1;
+  }
+  --waitset->nb_members;
+
+  while (waitset->exited_head == NULL) {
+    cond_wait(&waitset->cv, &waitset->mp);
+  }
+
+  tcb_t *tcb = waitset->exited_head;
+  waitset->exited_head = tcb->waitset_next;
+  if (waitset->exited_head == NULL) {
+    waitset->exited_tail = NULL;
+  }
+
+  mutex_unlock(&waitset->mp);
+
+  // Wait for the exiting thread to be done with its state mutex
+  mutex_lock(&tcb->mutex_state);
+  mutex_unlock(&tcb->mutex_state);
+
+  if (tidp != NULL) {
+    *tidp = tcb->library_tid;
+  }
+
+  // The thread has exited, clean things up like thr_join() does
+  thr_reap(tcb, statusp);
+
+  return 0;
+}
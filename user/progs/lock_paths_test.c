@@ -0,0 +1,615 @@
+/** @file lock_paths_test.c
+ *
+ *  @brief Exercises the contended paths of the synchronization primitives
+ *   built on top of the mutex
+ *
+ *  The test first runs readers, upgraders and writers on a reader biased
+ *  rwlock, under both ordering policies: upgraders take the lock in
+ *  RWLOCK_UPGRADABLE mode, upgrade it and downgrade it, and writers
+ *  downgrade it, while readers check that they never see a half-done
+ *  update. It then has threads signal a semaphore while other threads wait
+ *  on it, many of which are signaled before they made it to the list of
+ *  waiting threads. Finally, it reaps threads with a waitset, computes a
+ *  Fibonacci number with nested pool tasks, waits on futures, and has
+ *  readers check the record protected by a seqlock while it is updated.
+ *
+ *  Proper behavior: the test ends with REPORT_END_SUCCESS, without any
+ *  fault or hang.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <thread.h>
+#include <mutex.h>
+#include <rwlock.h>
+#include <sem.h>
+#include <syscall.h>
+#include <rwlock_policy.h>
+#include <rwlock_upgrade.h>
+#include <thr_waitset.h>
+#include <task_pool.h>
+#include <future.h>
+#include <seqlock.h>
+#include "410_tests.h"
+#include <test.h>
+DEF_TEST_NAME("lock_paths_test:");
+
+/** @brief Size of the thread stacks, large enough for nested pool tasks
+ */
+#define STACK_SIZE (16 * 4096)
+
+/** @brief Number of threads of each kind using the rwlock
+ */
+#define NB_RW_THREADS 4
+
+/** @brief Number of times each thread takes the rwlock
+ */
+#define NB_RW_ROUNDS 200
+
+/** @brief Number of threads waiting on the semaphore
+ */
+#define NB_SEM_WAITERS 4
+
+/** @brief Number of threads signaling the semaphore
+ */
+#define NB_SEM_SIGNALERS 2
+
+/** @brief Number of times each waiting thread waits on the semaphore
+ */
+#define NB_SEM_ROUNDS 500
+
+/** @brief Number of threads reaped through the waitset
+ */
+#define NB_WAITSET 16
+
+/** @brief Number of workers of the task pool
+ */
+#define NB_WORKERS 4
+
+/** @brief Rank of the Fibonacci number computed with pool tasks
+ */
+#define FIB_N 12
+
+/** @brief Value of the FIB_N-th Fibonacci number
+ */
+#define FIB_VALUE 144
+
+/** @brief Number of futures spawned in the task pool
+ */
+#define NB_FUTURES 32
+
+/** @brief Number of threads reading the record protected by the seqlock
+ */
+#define NB_SEQ_READERS 3
+
+/** @brief Number of updates of the record protected by the seqlock
+ */
+#define NB_SEQ_WRITES 2000
+
+/** @brief Exit status of a thread which saw an inconsistent state
+ */
+#define BAD_STATUS ((void *)-1)
+
+/** @brief The rwlock under test
+ */
+static rwlock_t rwlock;
+
+/** @brief Two counters which are always equal while nobody holds the rwlock
+ *   for writing
+ */
+static volatile int rw_first, rw_second;
+
+/** @brief Set while a thread holds the rwlock for writing
+ */
+static volatile int rw_writing;
+
+/** @brief The semaphore under test
+ */
+static sem_t sem;
+
+/** @brief The task pool under test
+ */
+static task_pool_t pool;
+
+/** @brief The seqlock under test
+ */
+static seqlock_t seqlock;
+
+/** @brief Two counters which are always equal when read consistently
+ */
+static volatile int seq_first, seq_second;
+
+/** @brief Set once the seqlock writer is done
+ */
+static volatile int seq_done;
+
+/** @brief Checks the counters protected by the rwlock from a read section
+ *
+ *  @return 0 if they are consistent, -1 otherwise
+ */
+static int rw_check(void) {
+  return (rw_writing || rw_first != rw_second) ? -1 : 0;
+}
+
+/** @brief Updates the counters protected by the rwlock from a write section,
+ *   giving other threads a chance to run in the middle
+ *
+ *  @param round The number of the caller's round
+ *
+ *  @return void
+ */
+static void rw_update(int round) {
+
+  rw_writing = 1;
+  ++rw_first;
+  if (!(round % 8)) {
+    yield(-1);
+  }
+  ++rw_second;
+  rw_writing = 0;
+}
+
+/** @brief Body of the threads taking the rwlock for reading
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL, or BAD_STATUS on an inconsistent read
+ */
+static void *rw_reader(void *arg) {
+
+  int i;
+  for (i = 0; i < NB_RW_ROUNDS; ++i) {
+    rwlock_lock(&rwlock, RWLOCK_READ);
+    int ret = rw_check();
+    rwlock_unlock(&rwlock);
+    if (ret < 0) {
+      return BAD_STATUS;
+    }
+  }
+
+  return NULL;
+}
+
+/** @brief Body of the threads taking the rwlock in RWLOCK_UPGRADABLE mode,
+ *   upgrading it and downgrading it
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL, or BAD_STATUS on an inconsistent read
+ */
+static void *rw_upgrader(void *arg) {
+
+  int i;
+  for (i = 0; i < NB_RW_ROUNDS; ++i) {
+    rwlock_lock(&rwlock, RWLOCK_UPGRADABLE);
+    int ret = rw_check();
+    rwlock_upgrade(&rwlock);
+    rw_update(i);
+    rwlock_downgrade(&rwlock);
+    if (rw_check() < 0) {
+      ret = -1;
+    }
+    rwlock_unlock(&rwlock);
+    if (ret < 0) {
+      return BAD_STATUS;
+    }
+  }
+
+  return NULL;
+}
+
+/** @brief Body of the threads taking the rwlock for writing and downgrading
+ *   it
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL, or BAD_STATUS on an inconsistent read
+ */
+static void *rw_writer(void *arg) {
+
+  int i;
+  for (i = 0; i < NB_RW_ROUNDS; ++i) {
+    rwlock_lock(&rwlock, RWLOCK_WRITE);
+    rw_update(i);
+    rwlock_downgrade(&rwlock);
+    int ret = rw_check();
+    rwlock_unlock(&rwlock);
+    if (ret < 0) {
+      return BAD_STATUS;
+    }
+  }
+
+  return NULL;
+}
+
+/** @brief Creates threads running the same function
+ *
+ *  @param func  The body of the threads
+ *  @param arg   The argument given to each of them
+ *  @param nb    The number of threads to create
+ *  @param tids  Where the tids of the threads are stored
+ *
+ *  @return 0 on success, -1 if a thread could not be created
+ */
+static int create_all(void *(*func)(void *), void *arg, int nb, int *tids) {
+
+  int i;
+  for (i = 0; i < nb; ++i) {
+    tids[i] = thr_create(func, arg);
+    if (tids[i] < 0) {
+      REPORT_MISC("Failed create");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/** @brief Joins threads which are expected to return NULL
+ *
+ *  @param nb    The number of threads
+ *  @param tids  The tids of the threads
+ *
+ *  @return 0 if all of them returned NULL, -1 otherwise
+ */
+static int join_all(int nb, int *tids) {
+
+  int ret = 0;
+  int i;
+  for (i = 0; i < nb; ++i) {
+    void *status;
+    if (thr_join(tids[i], &status) < 0 || status != NULL) {
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
+
+/** @brief Runs readers, upgraders and writers on a reader biased rwlock
+ *
+ *  @param policy The ordering policy of the rwlock
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int rw_paths(int policy) {
+
+  int tids[3 * NB_RW_THREADS];
+
+  if (rwlock_init(&rwlock) < 0 ||
+      rwlock_set_policy(&rwlock, policy | RWLOCK_READER_BIASED) < 0) {
+    REPORT_MISC("Failed rwlock setup");
+    return -1;
+  }
+  rw_first = rw_second = 0;
+
+  if (create_all(rw_reader, NULL, NB_RW_THREADS, tids) < 0 ||
+      create_all(rw_upgrader, NULL, NB_RW_THREADS,
+                 tids + NB_RW_THREADS) < 0 ||
+      create_all(rw_writer, NULL, NB_RW_THREADS,
+                 tids + 2 * NB_RW_THREADS) < 0) {
+    return -1;
+  }
+
+  if (join_all(3 * NB_RW_THREADS, tids) < 0) {
+    REPORT_MISC("Inconsistent read under the rwlock");
+    return -1;
+  }
+
+  if (rw_first != 2 * NB_RW_THREADS * NB_RW_ROUNDS ||
+      rw_second != rw_first) {
+    REPORT_MISC("Lost update under the rwlock");
+    return -1;
+  }
+
+  rwlock_destroy(&rwlock);
+  return 0;
+}
+
+/** @brief Body of the threads waiting on the semaphore
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL
+ */
+static void *sem_waiter(void *arg) {
+
+  int i;
+  for (i = 0; i < NB_SEM_ROUNDS; ++i) {
+    sem_wait(&sem);
+  }
+
+  return NULL;
+}
+
+/** @brief Body of the threads signaling the semaphore. They rarely yield, so
+ *   that resources are often handed over to waiting threads which have
+ *   decremented the count but are not on the list of waiting threads yet
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL
+ */
+static void *sem_signaler(void *arg) {
+
+  int nb = NB_SEM_WAITERS * NB_SEM_ROUNDS / NB_SEM_SIGNALERS;
+  int i;
+  for (i = 0; i < nb; ++i) {
+    sem_signal(&sem);
+    if (!(i % 16)) {
+      yield(-1);
+    }
+  }
+
+  return NULL;
+}
+
+/** @brief Has threads signal a semaphore as many times as other threads wait
+ *   on it. A resource lost on the way makes the test hang
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int sem_paths(void) {
+
+  int tids[NB_SEM_WAITERS + NB_SEM_SIGNALERS];
+
+  if (sem_init(&sem, 0) < 0) {
+    REPORT_MISC("Failed sem_init");
+    return -1;
+  }
+
+  if (create_all(sem_waiter, NULL, NB_SEM_WAITERS, tids) < 0 ||
+      create_all(sem_signaler, NULL, NB_SEM_SIGNALERS,
+                 tids + NB_SEM_WAITERS) < 0 ||
+      join_all(NB_SEM_WAITERS + NB_SEM_SIGNALERS, tids) < 0) {
+    REPORT_MISC("Failed semaphore round");
+    return -1;
+  }
+
+  // Nobody waits on the semaphore anymore, and no resource is left
+  if (sem.available_resources != 0 || sem.handoffs != 0) {
+    REPORT_MISC("Semaphore count is off");
+    return -1;
+  }
+
+  sem_destroy(&sem);
+  return 0;
+}
+
+/** @brief Body of the threads reaped through the waitset
+ *
+ *  @param arg The index of the thread
+ *
+ *  @return Its argument
+ */
+static void *waitset_child(void *arg) {
+
+  if ((int)arg & 1) {
+    yield(-1);
+  }
+
+  return arg;
+}
+
+/** @brief Reaps threads with a waitset, in whatever order they exit
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int waitset_paths(void) {
+
+  thr_waitset_t waitset;
+  int tids[NB_WAITSET];
+  int seen[NB_WAITSET];
+  int i;
+
+  if (thr_waitset_init(&waitset) < 0) {
+    REPORT_MISC("Failed thr_waitset_init");
+    return -1;
+  }
+
+  for (i = 0; i < NB_WAITSET; ++i) {
+    seen[i] = 0;
+    tids[i] = thr_create(waitset_child, (void *)i);
+    if (tids[i] < 0 || thr_waitset_add(&waitset, tids[i]) < 0) {
+      REPORT_MISC("Failed waitset add");
+      return -1;
+    }
+  }
+
+  for (i = 0; i < NB_WAITSET; ++i) {
+    int tid;
+    void *status;
+    if (thr_waitset_join(&waitset, &tid, &status) < 0) {
+      REPORT_MISC("Failed waitset join");
+      return -1;
+    }
+    int index = (int)status;
+    if (index < 0 || index >= NB_WAITSET || seen[index] ||
+        tids[index] != tid) {
+      REPORT_MISC("Bad waitset join");
+      return -1;
+    }
+    seen[index] = 1;
+  }
+
+  // Every thread of the set was joined
+  if (thr_waitset_join(&waitset, NULL, NULL) >= 0) {
+    REPORT_MISC("Waitset join succeeded on an empty set");
+    return -1;
+  }
+
+  thr_waitset_destroy(&waitset);
+  return 0;
+}
+
+/** @brief Computes a Fibonacci number, spawning a pool task for one of the
+ *   two recursive calls
+ *
+ *  @param arg The rank of the number
+ *
+ *  @return The number
+ */
+static void *fib(void *arg) {
+
+  int n = (int)arg;
+  if (n < 2) {
+    return arg;
+  }
+
+  pool_task_t ptask;
+  task_pool_spawn(&pool, &ptask, fib, (void *)(n - 1));
+  int second = (int)fib((void *)(n - 2));
+  int first = (int)task_pool_sync(&pool, &ptask);
+
+  return (void *)(first + second);
+}
+
+/** @brief Doubles a number, as a future's function
+ *
+ *  @param arg The number
+ *
+ *  @return Twice the number
+ */
+static void *double_it(void *arg) {
+  return (void *)(2 * (int)arg);
+}
+
+/** @brief Computes a Fibonacci number with nested pool tasks, then waits on
+ *   futures spawned in the same pool
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int pool_paths(void) {
+
+  static future_t futures[NB_FUTURES];
+  int ret = 0;
+  int i;
+
+  if (task_pool_init(&pool, NB_WORKERS) < 0) {
+    REPORT_MISC("Failed task_pool_init");
+    return -1;
+  }
+
+  pool_task_t ptask;
+  task_pool_submit(&pool, &ptask, fib, (void *)FIB_N);
+  if (task_pool_sync(&pool, &ptask) != (void *)FIB_VALUE) {
+    REPORT_MISC("Bad value of a pool task");
+    ret = -1;
+  }
+
+  for (i = 0; i < NB_FUTURES; ++i) {
+    if (future_init(&futures[i]) < 0) {
+      REPORT_MISC("Failed future_init");
+      return -1;
+    }
+    future_spawn(&pool, &futures[i], double_it, (void *)i);
+  }
+
+  for (i = 0; i < NB_FUTURES; ++i) {
+    void *value;
+    if (future_wait(&futures[i], &value) < 0 || value != (void *)(2 * i)) {
+      REPORT_MISC("Bad value of a future");
+      ret = -1;
+    }
+    future_destroy(&futures[i]);
+  }
+
+  task_pool_destroy(&pool);
+  return ret;
+}
+
+/** @brief Body of the thread updating the record protected by the seqlock
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL
+ */
+static void *seq_writer(void *arg) {
+
+  int i;
+  for (i = 0; i < NB_SEQ_WRITES; ++i) {
+    seqlock_write_lock(&seqlock);
+    ++seq_first;
+    if (!(i % 16)) {
+      yield(-1);
+    }
+    ++seq_second;
+    seqlock_write_unlock(&seqlock);
+  }
+  seq_done = 1;
+
+  return NULL;
+}
+
+/** @brief Body of the threads reading the record protected by the seqlock
+ *
+ *  @param arg Unused
+ *
+ *  @return NULL, or BAD_STATUS on an inconsistent read
+ */
+static void *seq_reader(void *arg) {
+
+  while (!seq_done) {
+    unsigned int sequence;
+    int first, second;
+    do {
+      sequence = seqlock_read_begin(&seqlock);
+      first = seq_first;
+      second = seq_second;
+    } while (seqlock_read_retry(&seqlock, sequence));
+
+    if (first != second) {
+      return BAD_STATUS;
+    }
+  }
+
+  return NULL;
+}
+
+/** @brief Has readers check the record protected by a seqlock while a
+ *   writer updates it
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int seq_paths(void) {
+
+  int tids[NB_SEQ_READERS + 1];
+
+  if (seqlock_init(&seqlock) < 0) {
+    REPORT_MISC("Failed seqlock_init");
+    return -1;
+  }
+
+  if (create_all(seq_reader, NULL, NB_SEQ_READERS, tids) < 0 ||
+      create_all(seq_writer, NULL, 1, tids + NB_SEQ_READERS) < 0) {
+    return -1;
+  }
+
+  if (join_all(NB_SEQ_READERS + 1, tids) < 0) {
+    REPORT_MISC("Inconsistent read under the seqlock");
+    return -1;
+  }
+
+  seqlock_destroy(&seqlock);
+  return 0;
+}
+
+int main() {
+
+  REPORT_LOCAL_INIT;
+  REPORT_START_CMPLT;
+
+  thr_init(STACK_SIZE);
+
+  if (rw_paths(RWLOCK_WRITER_PREFERRING) < 0 ||
+      rw_paths(RWLOCK_PHASE_FAIR) < 0 || sem_paths() < 0 ||
+      waitset_paths() < 0 || pool_paths() < 0 || seq_paths() < 0) {
+    REPORT_END_FAIL;
+    thr_exit((void *)-1);
+  }
+
+  REPORT_END_SUCCESS;
+  thr_exit((void *)0);
+
+  return 0;
+}
@@ -0,0 +1,263 @@
+/** @file thr_lifecycle_test.c
+ *
+ *  @brief Exercises the thread life cycle paths which reclaim TCBs and
+ *   stacks
+ *
+ *  The test first creates and detaches many short-lived threads, half of them
+ *  detaching themselves, so that TCBs, stacks and library tids are reclaimed
+ *  and reused while threads are still exiting. It then creates threads with
+ *  large stacks (thr_create_sized()), which use their whole stack and are
+ *  joined. Finally, it asks thr_create_n() for more threads than the task
+ *  may be able to create, joins whatever was created, and checks that the
+ *  library still creates threads afterwards.
+ *
+ *  Proper behavior: the test ends with REPORT_END_SUCCESS, without any
+ *  fault.
+ *
+ *  @author akanjani, lramire1
+ */
+
+#include <thread.h>
+#include <mutex.h>
+#include <syscall.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <thr_detach.h>
+#include <thr_create_n.h>
+#include <thr_create_sized.h>
+#include "410_tests.h"
+#include <test.h>
+DEF_TEST_NAME("thr_lifecycle_test:");
+
+/** @brief Size of the regular thread stacks
+ */
+#define STACK_SIZE 4096
+
+/** @brief Size of the stacks of the threads created with thr_create_sized()
+ */
+#define SIZED_STACK_SIZE (8 * STACK_SIZE)
+
+/** @brief Number of bytes of its stack a sized thread fills
+ */
+#define SIZED_STACK_USE (6 * STACK_SIZE)
+
+/** @brief Number of detached threads created
+ */
+#define NB_CHURN 2000
+
+/** @brief Number of sized threads created and joined
+ */
+#define NB_SIZED 32
+
+/** @brief Number of threads asked to thr_create_n() at once
+ */
+#define NB_MANY 1024
+
+/** @brief Number of threads created by thr_create_n() once the big request
+ *   is over
+ */
+#define NB_AFTER 8
+
+/** @brief Number of detached threads which ran to completion
+ */
+static volatile int nb_exited = 0;
+
+/** @brief A mutex protecting nb_exited
+ */
+static mutex_t exited_lock;
+
+/** @brief Body of the detached threads
+ *
+ *  @param arg An odd value if the thread detaches itself
+ *
+ *  @return Its argument
+ */
+static void *churn_child(void *arg) {
+
+  if ((int)arg & 1) {
+    thr_detach(thr_getid());
+  }
+
+  mutex_lock(&exited_lock);
+  ++nb_exited;
+  mutex_unlock(&exited_lock);
+
+  return arg;
+}
+
+/** @brief Body of the sized threads, which use most of their stack
+ *
+ *  @param arg Any value
+ *
+ *  @return Its argument, if the stack held what was written to it
+ */
+static void *sized_child(void *arg) {
+
+  volatile char buffer[SIZED_STACK_USE];
+  int i;
+
+  for (i = 0; i < SIZED_STACK_USE; ++i) {
+    buffer[i] = (char)i;
+  }
+  for (i = 0; i < SIZED_STACK_USE; ++i) {
+    if (buffer[i] != (char)i) {
+      return NULL;
+    }
+  }
+
+  return arg;
+}
+
+/** @brief Body of the threads created with thr_create_n()
+ *
+ *  @param arg Any value
+ *
+ *  @return Its argument
+ */
+static void *many_child(void *arg) {
+  return arg;
+}
+
+/** @brief Creates and detaches NB_CHURN threads, and waits for all of them to
+ *   run to completion
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int churn(void) {
+
+  int i;
+
+  // All the threads of a previous round already ran to completion
+  nb_exited = 0;
+
+  for (i = 0; i < NB_CHURN; ++i) {
+    int tid = thr_create(churn_child, (void *)i);
+    if (tid < 0) {
+      REPORT_MISC("Failed create of a detached thread");
+      return -1;
+    }
+    if (!(i & 1) && thr_detach(tid) < 0) {
+      REPORT_MISC("Failed detach");
+      return -1;
+    }
+  }
+
+  while (nb_exited < NB_CHURN) {
+    yield(-1);
+  }
+
+  return 0;
+}
+
+/** @brief Creates and joins NB_SIZED threads with large stacks
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int sized(void) {
+
+  int i;
+
+  for (i = 0; i < NB_SIZED; ++i) {
+    int tid = thr_create_sized(sized_child, (void *)(i + 1),
+                               SIZED_STACK_SIZE);
+    if (tid < 0) {
+      REPORT_MISC("Failed create of a sized thread");
+      return -1;
+    }
+
+    void *status;
+    if (thr_join(tid, &status) < 0 || status != (void *)(i + 1)) {
+      REPORT_MISC("Bad join of a sized thread");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/** @brief Joins the threads created by thr_create_n()
+ *
+ *  @param tids The library tids of the threads
+ *  @param nb   The number of threads
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int join_many(int *tids, int nb) {
+
+  int i;
+
+  for (i = 0; i < nb; ++i) {
+    void *status;
+    if (thr_join(tids[i], &status) < 0 || status != (void *)i) {
+      REPORT_MISC("Bad join of a thread created by thr_create_n()");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/** @brief Asks thr_create_n() for NB_MANY threads, which may partially fail,
+ *   then checks that it still works for NB_AFTER threads
+ *
+ *  @return 0 on success, -1 on failure
+ */
+static int many(void) {
+
+  int *tids = malloc(NB_MANY * sizeof(int));
+  void **args = malloc(NB_MANY * sizeof(void *));
+  if (tids == NULL || args == NULL) {
+    REPORT_MISC("Failed malloc");
+    return -1;
+  }
+
+  int i;
+  for (i = 0; i < NB_MANY; ++i) {
+    args[i] = (void *)i;
+  }
+
+  // An overflowing number of threads must be refused
+  if (thr_create_n(INT_MAX, many_child, args, tids) >= 0) {
+    REPORT_MISC("thr_create_n() accepted INT_MAX threads");
+    return -1;
+  }
+
+  // Either all the threads, some of them or none of them are created
+  int ret = 0;
+  int nb = thr_create_n(NB_MANY, many_child, args, tids);
+  if (nb > NB_MANY || (nb > 0 && join_many(tids, nb) < 0)) {
+    ret = -1;
+  } else {
+    // The threads which were not created must not have leaked anything
+    nb = thr_create_n(NB_AFTER, many_child, args, tids);
+    if (nb != NB_AFTER || join_many(tids, nb) < 0) {
+      REPORT_MISC("thr_create_n() failed after a big request");
+      ret = -1;
+    }
+  }
+
+  free(tids);
+  free(args);
+
+  return ret;
+}
+
+int main() {
+
+  REPORT_LOCAL_INIT;
+  REPORT_START_CMPLT;
+
+  thr_init(STACK_SIZE);
+
+  REPORT_ON_ERR(mutex_init(&exited_lock));
+
+  if (churn() < 0 || sized() < 0 || many() < 0 || churn() < 0) {
+    REPORT_END_FAIL;
+    thr_exit((void *)-1);
+  }
+
+  REPORT_END_SUCCESS;
+  thr_exit((void *)0);
+
+  return 0;
+}